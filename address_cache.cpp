@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "address_cache.hpp"
+#include "exceptions.hpp"
+#include "logging.hpp"
+
+namespace fnc
+{
+
+address_cache& address_cache::instance()
+{
+    static address_cache cache;
+    return cache;
+}
+
+address_cache::address_cache()
+    : wake_fd_(-1),
+      stopping_(false),
+      lookups_(0),
+      updates_(0),
+      resyncs_(0)
+{
+    // Listen before dumping, so a change made while the dump is running is not missed
+    monitor_.set_nonblocking();
+    monitor_.add_membership(RTNLGRP_IPV4_IFADDR);
+    monitor_.add_membership(RTNLGRP_IPV6_IFADDR);
+    load();
+
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create address cache wake event: {}", strerror(errno));
+    }
+    listener_ = std::thread([this] { run(); });
+}
+
+address_cache::~address_cache()
+{
+    stopping_.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+    {
+        LOG_WARN("Failed to wake address cache listener: {}", strerror(errno));
+    }
+    listener_.join();
+    close(wake_fd_);
+}
+
+std::vector<ip_address> address_cache::get(iface_idx_t index, const ip_family_type& ip_family) const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    bool get_v4 = (ip_family & ip_family_type::v4) == ip_family_type::v4;
+    bool get_v6 = (ip_family & ip_family_type::v6) == ip_family_type::v6;
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = addresses_.find(index);
+    if (it == addresses_.end())
+    {
+        return {};
+    }
+    if (get_v4 && get_v6)
+    {
+        return it->second;
+    }
+    std::vector<ip_address> addresses;
+    std::copy_if(it->second.begin(), it->second.end(), std::back_inserter(addresses), [&](const ip_address& address) {
+        return address.is_v4() ? get_v4 : get_v6;
+    });
+    return addresses;
+}
+
+bool address_cache::contains(iface_idx_t index, const ip_address& address) const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = addresses_.find(index);
+    return it != addresses_.end() && std::find(it->second.begin(), it->second.end(), address) != it->second.end();
+}
+
+bool address_cache::wait_for(iface_idx_t index, const std::function<bool(const std::vector<ip_address>&)>& check, const deadline& limit) const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    static const std::vector<ip_address> none;
+    auto passes = [&]{
+        auto it = addresses_.find(index);
+        return check(it == addresses_.end() ? none : it->second);
+    };
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (limit.is_never())
+    {
+        changed_.wait(lock, passes);
+        return true;
+    }
+    return changed_.wait_for(lock, limit.remaining(), passes);
+}
+
+void address_cache::resync()
+{
+    load();
+    resyncs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+address_cache_stats address_cache::get_stats() const
+{
+    address_cache_stats stats;
+    stats.lookups = lookups_.load(std::memory_order_relaxed);
+    stats.updates = updates_.load(std::memory_order_relaxed);
+    stats.resyncs = resyncs_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void address_cache::load()
+{
+    // A session of its own, so the replies to the dump never mix with the notifications
+    netlink nl;
+    std::unordered_map<iface_idx_t, std::vector<ip_address>> addresses;
+    size_t count = 0;
+    nl_msg message = nl.init_message(RTM_GETADDR, NLM_F_REQUEST | NLM_F_DUMP);
+    message.get_header<struct ifaddrmsg>()->ifa_family = AF_UNSPEC;
+    nl.send_dump_sync(message, [&]{ addresses.clear(); count = 0; }, [&](struct nlmsghdr* msg_ptr) {
+        iface_idx_t index = -1;
+        std::optional<ip_address> address = parse_address_info(msg_ptr, index);
+        if (address)
+        {
+            addresses[index].push_back(std::move(*address));
+            count++;
+        }
+    });
+    LOG_DEBUG("Loaded {} addresses of {} interfaces into the address cache", count, addresses.size());
+
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        addresses_.swap(addresses);
+    }
+    changed_.notify_all();
+}
+
+void address_cache::run()
+{
+    while (!stopping_.load(std::memory_order_acquire))
+    {
+        struct pollfd fds[2];
+        fds[0].fd = monitor_.get_fd();
+        fds[0].events = POLLIN;
+        fds[1].fd = wake_fd_;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            LOG_WARN("Stopped listening for address changes, the address cache will not be updated: {}", strerror(errno));
+            return;
+        }
+
+        try
+        {
+            while (monitor_.receive_available([this](struct nlmsghdr* msg_ptr) { apply(msg_ptr); }))
+            { }
+        }
+        catch (const inconsistent_dump&)
+        {
+            // Some notifications were lost, so the only way to know what changed is to look at everything again
+            LOG_DEBUG("Lost address notifications, dumping the addresses again");
+            try
+            {
+                resync();
+            }
+            catch (const fnc_exception& ex)
+            {
+                LOG_WARN("Failed to dump the addresses again, the address cache may be out of date: {}", ex.message);
+            }
+        }
+        catch (const fnc_exception& ex)
+        {
+            LOG_WARN("Stopped listening for address changes, the address cache will not be updated: {}", ex.message);
+            return;
+        }
+    }
+}
+
+void address_cache::apply(struct nlmsghdr* msg_ptr)
+{
+    if ((msg_ptr->nlmsg_type != RTM_NEWADDR && msg_ptr->nlmsg_type != RTM_DELADDR) ||
+        msg_ptr->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+    {
+        return;
+    }
+    iface_idx_t index = -1;
+    std::optional<ip_address> address = parse_address_info(msg_ptr, index);
+    if (!address)
+    {
+        return;
+    }
+    updates_.fetch_add(1, std::memory_order_relaxed);
+
+    // An address that is already there is being changed, e.g. its lifetime or flags, and keeps its place
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        std::vector<ip_address>& addresses = addresses_[index];
+        auto existing = std::find(addresses.begin(), addresses.end(), *address);
+        if (msg_ptr->nlmsg_type == RTM_NEWADDR && existing == addresses.end())
+        {
+            addresses.push_back(std::move(*address));
+        }
+        else if (msg_ptr->nlmsg_type == RTM_DELADDR && existing != addresses.end())
+        {
+            addresses.erase(existing);
+        }
+        if (addresses.empty())
+        {
+            addresses_.erase(index);
+        }
+    }
+    changed_.notify_all();
+}
+
+} // end namespace fnc
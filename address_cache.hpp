@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ip_address.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+#include "util/deadline.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Counters for the activity of an address_cache
+ */
+struct address_cache_stats
+{
+    uint64_t lookups = 0;           ///< Number of lookups answered, whether the interface had addresses or not
+    uint64_t updates = 0;           ///< Number of address notifications applied
+    uint64_t resyncs = 0;           ///< Number of times the table was dumped again, after the first
+};
+
+/**
+ * @brief Table of the IPv4 and IPv6 addresses of every interface on the host, kept current by
+ * RTNLGRP_IPV4_IFADDR and RTNLGRP_IPV6_IFADDR notifications
+ *
+ * The table is filled with one dump of every address, and a listener thread applies the notifications the kernel
+ * sends when an address is added, changed or deleted, including the deletes for the addresses of a link that goes
+ * away. A lookup only takes a shared lock and copies the addresses of one interface out, so it costs the same
+ * whether the host has ten addresses or tens of thousands. If notifications are lost to a receive queue overflow,
+ * the table is dumped again.
+ *
+ * The table follows the kernel instead of being part of it, so a change shows up shortly after the request that
+ * made it has returned. netiface waits for its own changes to show up before returning.
+ *
+ * All of the methods are safe to call from any thread.
+ *
+ * @example
+ * @code
+ * netiface eth0("eth0");
+ * eth0.use_address_cache(&address_cache::instance());
+ * std::vector<ip_address> addresses = eth0.get_ip_addresses();
+ * @endcode
+ */
+class address_cache
+{
+public:
+    /**
+     * @brief Get the cache shared by the whole process, which is filled the first time it is used
+     */
+    static address_cache& instance();
+
+    /**
+     * Constructor, which dumps the addresses and starts the listener thread
+     */
+    address_cache();
+
+    /**
+     * Destructor, which stops the listener thread
+     */
+    virtual ~address_cache();
+
+    address_cache(const address_cache&) = delete;
+    address_cache& operator=(const address_cache&) = delete;
+
+    /**
+     * @brief Get the addresses of an interface, with their prefix lengths, in the order they were added
+     *
+     * @param index         the index of the interface
+     * @param ip_family     The family of addresses to return - ipv4, ipv6, or both
+     * @return the addresses, or an empty list if there is no interface with the index
+     */
+    std::vector<ip_address> get(iface_idx_t index, const ip_family_type& ip_family = ip_family_type::all) const;
+
+    /**
+     * @brief Check if an interface has an address, with the same prefix length
+     */
+    bool contains(iface_idx_t index, const ip_address& address) const;
+
+    /**
+     * @brief Wait until the addresses of an interface pass a check
+     *
+     * The check is made straight away, and again each time the table changes, so the caller wakes as soon as the
+     * notification it is waiting for has been applied
+     *
+     * @param index     the index of the interface
+     * @param check     called with the addresses of the interface while the table is locked
+     * @param limit     how long to wait
+     * @return false if the deadline passed first
+     */
+    bool wait_for(iface_idx_t index, const std::function<bool(const std::vector<ip_address>&)>& check, const deadline& limit) const;
+
+    /**
+     * @brief Dump the addresses again and replace the table
+     */
+    void resync();
+
+    /**
+     * @brief Get the activity counters for this cache
+     *
+     * @return a copy of the counters
+     */
+    address_cache_stats get_stats() const;
+
+private:
+    mutable std::shared_mutex mutex_;
+    mutable std::condition_variable_any changed_;
+    std::unordered_map<iface_idx_t, std::vector<ip_address>> addresses_;
+    netlink monitor_;
+    int wake_fd_;
+    std::atomic<bool> stopping_;
+    mutable std::atomic<uint64_t> lookups_;
+    std::atomic<uint64_t> updates_;
+    std::atomic<uint64_t> resyncs_;
+    std::thread listener_;
+
+    void load();
+    void run();
+    void apply(struct nlmsghdr* msg_ptr);
+};
+
+} // end namespace fnc
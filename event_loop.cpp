@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+#include "logging.hpp"
+
+namespace fnc
+{
+
+event_loop::event_loop()
+    : epoll_fd_(-1),
+      wake_fd_(-1),
+      stopped_(false),
+      events_(64)
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create epoll instance: {}", strerror(errno));
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0)
+    {
+        int eventfd_errno = errno;
+        close(epoll_fd_);
+        THROW_NETEX("Failed to create eventfd: {}", strerror(eventfd_errno));
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) < 0)
+    {
+        int epoll_errno = errno;
+        close(wake_fd_);
+        close(epoll_fd_);
+        THROW_NETEX("Failed to watch eventfd: {}", strerror(epoll_errno));
+    }
+}
+
+event_loop::~event_loop()
+{
+    close(wake_fd_);
+    close(epoll_fd_);
+}
+
+void event_loop::add(int fd, uint32_t events, fd_handler handler)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        THROW_NETEX("Failed to watch fd={}: {}", fd, strerror(errno));
+    }
+    handlers_[fd] = std::make_shared<fd_handler>(std::move(handler));
+}
+
+void event_loop::remove(int fd)
+{
+    if (handlers_.erase(fd) == 0)
+    {
+        return;
+    }
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) < 0)
+    {
+        LOG_DEBUG("Failed to stop watching fd={}: {}", fd, strerror(errno));
+    }
+}
+
+void event_loop::post(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(posted_lock_);
+        posted_.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        THROW_NETEX("Failed to wake event loop: {}", strerror(errno));
+    }
+}
+
+void event_loop::call_after(std::chrono::milliseconds delay, std::function<void()> task)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0)
+    {
+        THROW_NETEX("Failed to create timer: {}", strerror(errno));
+    }
+
+    // A zero it_value disarms the timer, so always wait at least a nanosecond
+    struct itimerspec expiry;
+    memset(&expiry, 0, sizeof(expiry));
+    auto nsec = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count(), 1);
+    expiry.it_value.tv_sec = nsec / 1000000000;
+    expiry.it_value.tv_nsec = nsec % 1000000000;
+    if (timerfd_settime(timer_fd, 0, &expiry, nullptr) < 0)
+    {
+        int timer_errno = errno;
+        close(timer_fd);
+        THROW_NETEX("Failed to arm timer: {}", strerror(timer_errno));
+    }
+
+    add(timer_fd, EPOLLIN, [this, timer_fd, task = std::move(task)](uint32_t) {
+        remove(timer_fd);
+        close(timer_fd);
+        task();
+    });
+}
+
+bool event_loop::run_once(std::chrono::milliseconds timeout)
+{
+    int count = epoll_wait(epoll_fd_, events_.data(), events_.size(), timeout.count());
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {
+            return true;
+        }
+        THROW_NETEX("Error waiting for events: {}", strerror(errno));
+    }
+
+    for (int idx = 0; idx < count; ++idx)
+    {
+        int fd = events_[idx].data.fd;
+        if (fd == wake_fd_)
+        {
+            uint64_t value;
+            if (read(wake_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            {
+                THROW_NETEX("Failed to read eventfd: {}", strerror(errno));
+            }
+            run_posted();
+            continue;
+        }
+
+        // Hold a reference so the handler survives being removed while it runs
+        auto it = handlers_.find(fd);
+        if (it == handlers_.end())
+        {
+            continue;
+        }
+        std::shared_ptr<fd_handler> handler = it->second;
+        (*handler)(events_[idx].events);
+    }
+    return count > 0;
+}
+
+void event_loop::run()
+{
+    stopped_ = false;
+    while (!stopped_)
+    {
+        run_once();
+    }
+}
+
+void event_loop::stop()
+{
+    post([this]{ stopped_ = true; });
+}
+
+void event_loop::run_posted()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> guard(posted_lock_);
+        tasks.swap(posted_);
+    }
+    for (auto& task : tasks)
+    {
+        task();
+    }
+}
+
+} // end namespace fnc
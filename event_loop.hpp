@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
+
+#include "exceptions.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Single threaded event loop built on epoll
+ *
+ * File descriptors are registered with a handler that is called from run()/run_once() when the descriptor is
+ * ready. Everything except post() and stop() must be called from the thread that runs the loop.
+ */
+class event_loop
+{
+public:
+    using fd_handler = std::function<void(uint32_t events)>;
+
+    event_loop();
+    virtual ~event_loop();
+
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    /**
+     * @brief Start watching a file descriptor
+     *
+     * @param fd        the file descriptor to watch
+     * @param events    the epoll events to watch for, e.g. EPOLLIN
+     * @param handler   called with the ready events each time the descriptor is ready
+     */
+    void add(int fd, uint32_t events, fd_handler handler);
+
+    /**
+     * @brief Stop watching a file descriptor
+     *
+     * This is safe to call from inside a handler, including the handler for fd itself
+     *
+     * @param fd    the file descriptor to stop watching
+     */
+    void remove(int fd);
+
+    /**
+     * @brief Run a function on the loop thread
+     *
+     * This is safe to call from any thread
+     *
+     * @param task  the function to run
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * @brief Run a function on the loop thread after a delay
+     *
+     * @param delay     how long to wait
+     * @param task      the function to run
+     */
+    void call_after(std::chrono::milliseconds delay, std::function<void()> task);
+
+    /**
+     * @brief Wait for and dispatch one round of events
+     *
+     * @param timeout   how long to wait for an event
+     * @return false if the timeout expired without any events
+     */
+    bool run_once(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+    /**
+     * @brief Dispatch events until stop() is called
+     */
+    void run();
+
+    /**
+     * @brief Make run() return
+     *
+     * This is safe to call from any thread
+     */
+    void stop();
+
+    /**
+     * @brief Dispatch events until a future is ready and return its value
+     *
+     * @param result        the future to wait for
+     * @param idle_timeout  how long to wait without any events before giving up
+     * @return the value of the future
+     */
+    template <typename T>
+    T wait(std::future<T>& result, std::chrono::milliseconds idle_timeout = std::chrono::seconds(2))
+    {
+        while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!run_once(idle_timeout))
+            {
+                THROW_TIMEOUT("Timeout waiting for event loop operation to complete");
+            }
+        }
+        return result.get();
+    }
+
+private:
+    int epoll_fd_;
+    int wake_fd_;
+    bool stopped_;
+    std::unordered_map<int, std::shared_ptr<fd_handler>> handlers_;
+    std::vector<struct epoll_event> events_;
+    std::mutex posted_lock_;
+    std::vector<std::function<void()>> posted_;
+
+    void run_posted();
+};
+
+} // end namespace fnc
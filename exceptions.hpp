@@ -68,6 +68,17 @@ class network_exception : public fnc_exception
     using fnc_exception::fnc_exception;
 };
 
+/**
+ * @brief Exception thrown when the reply to a netlink dump cannot be trusted to be complete
+ *
+ * Either the objects changed while they were being dumped (NLM_F_DUMP_INTR), or the receive queue overflowed and
+ * replies were lost (ENOBUFS). Asking for the dump again is expected to succeed
+ */
+class inconsistent_dump : public network_exception
+{
+    using network_exception::network_exception;
+};
+
 /**
  * @brief Exception thrown when there is a timeout
  */
@@ -76,6 +87,14 @@ class timeout_exception : public fnc_exception
     using fnc_exception::fnc_exception;
 };
 
+/**
+ * @brief Exception thrown when an operation was cancelled before it finished
+ */
+class cancelled_exception : public fnc_exception
+{
+    using fnc_exception::fnc_exception;
+};
+
 class illegal_argument : public fnc_exception
 {
     using fnc_exception::fnc_exception;
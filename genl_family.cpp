@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <linux/genetlink.h>
+
+#include "exceptions.hpp"
+#include "genl_family.hpp"
+#include "logging.hpp"
+#include "netlink_attrs.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Get the attributes of a generic netlink message, which follow the genlmsghdr
+ */
+template <unsigned short MaxType>
+static attr_table<MaxType> genl_attrs(const struct nlmsghdr* msg_ptr)
+{
+    const char* first = static_cast<const char*>(NLMSG_DATA(msg_ptr)) + GENL_HDRLEN;
+    return attr_table<MaxType>(reinterpret_cast<const struct rtattr*>(first), msg_ptr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+/**
+ * @brief Call a function with each entry of a nested array attribute, such as CTRL_ATTR_OPS
+ */
+template <unsigned short MaxType, typename Function>
+static void for_each_nested(attr_bytes array, Function function)
+{
+    int len = array.len;
+    for (const struct rtattr* entry = reinterpret_cast<const struct rtattr*>(array.data); RTA_OK(entry, len); entry = RTA_NEXT(entry, len))
+    {
+        function(attr_table<MaxType>(static_cast<const struct rtattr*>(RTA_DATA(entry)), RTA_PAYLOAD(entry)));
+    }
+}
+
+/**
+ * @brief Parse a CTRL_CMD_NEWFAMILY message
+ *
+ * @return false if it is some other kind of message
+ */
+static bool parse_family(const struct nlmsghdr* msg_ptr, genl_family& family)
+{
+    if (msg_ptr->nlmsg_type != GENL_ID_CTRL || msg_ptr->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN) ||
+        static_cast<const struct genlmsghdr*>(NLMSG_DATA(msg_ptr))->cmd != CTRL_CMD_NEWFAMILY)
+    {
+        return false;
+    }
+
+    attr_table<CTRL_ATTR_MAX> attrs = genl_attrs<CTRL_ATTR_MAX>(msg_ptr);
+    attrs.get(CTRL_ATTR_FAMILY_ID, family.id);
+    family.name = std::string(attrs.get_string(CTRL_ATTR_FAMILY_NAME));
+    attrs.get(CTRL_ATTR_VERSION, family.version);
+    attrs.get(CTRL_ATTR_HDRSIZE, family.hdrsize);
+    attrs.get(CTRL_ATTR_MAXATTR, family.maxattr);
+    family.ops.clear();
+    for_each_nested<CTRL_ATTR_OP_MAX>(attrs.get_bytes(CTRL_ATTR_OPS), [&](const attr_table<CTRL_ATTR_OP_MAX>& op_attrs) {
+        genl_op op;
+        op_attrs.get(CTRL_ATTR_OP_ID, op.id);
+        op_attrs.get(CTRL_ATTR_OP_FLAGS, op.flags);
+        family.ops.push_back(op);
+    });
+    family.groups.clear();
+    for_each_nested<CTRL_ATTR_MCAST_GRP_MAX>(attrs.get_bytes(CTRL_ATTR_MCAST_GROUPS), [&](const attr_table<CTRL_ATTR_MCAST_GRP_MAX>& group_attrs) {
+        genl_mcast_group group;
+        group.name = std::string(group_attrs.get_string(CTRL_ATTR_MCAST_GRP_NAME));
+        group_attrs.get(CTRL_ATTR_MCAST_GRP_ID, group.id);
+        family.groups.push_back(group);
+    });
+    return family.id != 0;
+}
+
+bool genl_family::has_op(uint32_t cmd) const
+{
+    return std::any_of(ops.begin(), ops.end(), [cmd](const genl_op& op) { return op.id == cmd; });
+}
+
+uint32_t genl_family::get_group_id(const std::string& group) const
+{
+    auto it = std::find_if(groups.begin(), groups.end(), [&group](const genl_mcast_group& item) { return item.name == group; });
+    if (it == groups.end())
+    {
+        THROW_NETEX("Generic netlink family={} does not have multicast group={}", name, group);
+    }
+    return it->id;
+}
+
+genl_family_cache& genl_family_cache::instance()
+{
+    static genl_family_cache cache;
+    return cache;
+}
+
+genl_family_cache::genl_family_cache()
+{ }
+
+genl_family_cache::~genl_family_cache()
+{ }
+
+std::shared_ptr<const genl_family> genl_family_cache::get(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!session_)
+    {
+        session_ = std::make_unique<netlink>(NETLINK_GENERIC);
+        start_monitor();
+    }
+    read_notifications();
+
+    auto it = families_.find(name);
+    if (it != families_.end())
+    {
+        stats_.hits++;
+        return it->second;
+    }
+    stats_.misses++;
+    std::shared_ptr<const genl_family> family = resolve(name);
+    families_[name] = family;
+    return family;
+}
+
+uint16_t genl_family_cache::get_family_id(const std::string& name)
+{
+    return get(name)->id;
+}
+
+uint32_t genl_family_cache::get_group_id(const std::string& family, const std::string& group)
+{
+    return get(family)->get_group_id(group);
+}
+
+void genl_family_cache::invalidate(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    families_.erase(name);
+}
+
+void genl_family_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    families_.clear();
+}
+
+genl_cache_stats genl_family_cache::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::shared_ptr<const genl_family> genl_family_cache::resolve(const std::string& name)
+{
+    nl_msg message = session_->init_genl_message(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 1, NLM_F_REQUEST | NLM_F_ACK);
+    message.add_string(CTRL_ATTR_FAMILY_NAME, name);
+
+    auto family = std::make_shared<genl_family>();
+    bool found = false;
+    session_->send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
+        found = parse_family(msg_ptr, *family) || found;
+    });
+    if (!found)
+    {
+        THROW_NETEX("Generic netlink family={} was not found", name);
+    }
+    LOG_DEBUG("Resolved generic netlink family={} id={}", name, family->id);
+    return family;
+}
+
+void genl_family_cache::start_monitor()
+{
+    // The controller is there as long as the kernel is, so it is looked up before anything can be invalidated
+    try
+    {
+        std::shared_ptr<const genl_family> nlctrl = resolve(CTRL_NAME);
+        auto monitor = std::make_unique<netlink>(NETLINK_GENERIC);
+        monitor->set_nonblocking();
+        monitor->add_membership(nlctrl->get_group_id("notify"));
+        monitor_ = std::move(monitor);
+        families_[nlctrl->name] = nlctrl;
+    }
+    catch (const fnc_exception&)
+    {
+        LOG_WARN("Failed to listen for generic netlink family changes, cached families will not be invalidated");
+    }
+}
+
+void genl_family_cache::read_notifications()
+{
+    if (!monitor_)
+    {
+        return;
+    }
+    try
+    {
+        while (monitor_->receive_available([&](struct nlmsghdr* msg_ptr) {
+            if (msg_ptr->nlmsg_type != GENL_ID_CTRL || msg_ptr->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+            {
+                return;
+            }
+            switch (static_cast<const struct genlmsghdr*>(NLMSG_DATA(msg_ptr))->cmd)
+            {
+                case CTRL_CMD_NEWFAMILY:
+                case CTRL_CMD_DELFAMILY:
+                case CTRL_CMD_NEWMCAST_GRP:
+                case CTRL_CMD_DELMCAST_GRP:
+                    break;
+
+                default:
+                    return;
+            }
+            std::string name(genl_attrs<CTRL_ATTR_MAX>(msg_ptr).get_string(CTRL_ATTR_FAMILY_NAME));
+            if (families_.erase(name) > 0)
+            {
+                LOG_DEBUG("Generic netlink family={} changed, dropping it from the cache", name);
+                stats_.invalidations++;
+            }
+        }))
+        { }
+    }
+    catch (const inconsistent_dump&)
+    {
+        // Some notifications were lost, so nothing cached can be trusted
+        LOG_DEBUG("Lost generic netlink family notifications, dropping {} cached families", families_.size());
+        stats_.invalidations += families_.size();
+        families_.clear();
+    }
+    catch (const fnc_exception&)
+    {
+        LOG_WARN("Stopped listening for generic netlink family changes, cached families will not be invalidated");
+        monitor_.reset();
+        families_.clear();
+    }
+}
+
+} // end namespace fnc
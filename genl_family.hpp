@@ -0,0 +1,162 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "netlink.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief A command that a generic netlink family supports
+ */
+struct genl_op
+{
+    uint32_t id = 0;
+    uint32_t flags = 0;             ///< GENL_ADMIN_PERM and friends
+};
+
+/**
+ * @brief A multicast group of a generic netlink family
+ */
+struct genl_mcast_group
+{
+    std::string name;
+    uint32_t id = 0;
+};
+
+/**
+ * @brief What the kernel reports about a generic netlink family, such as "ethtool" or "wireguard"
+ */
+struct genl_family
+{
+    uint16_t id = 0;
+    std::string name;
+    uint32_t version = 0;
+    uint32_t hdrsize = 0;           ///< Size of the family header that follows the genlmsghdr
+    uint32_t maxattr = 0;
+    std::vector<genl_op> ops;
+    std::vector<genl_mcast_group> groups;
+
+    /**
+     * @brief Check if the family supports a command
+     */
+    bool has_op(uint32_t cmd) const;
+
+    /**
+     * @brief Get the ID of a multicast group of the family
+     *
+     * Throws a network_exception if the family does not have the group
+     */
+    uint32_t get_group_id(const std::string& group) const;
+};
+
+/**
+ * @brief Counters for the activity of a genl_family_cache
+ */
+struct genl_cache_stats
+{
+    uint64_t hits = 0;              ///< Number of lookups answered from the cache
+    uint64_t misses = 0;            ///< Number of lookups that asked the kernel
+    uint64_t invalidations = 0;     ///< Number of families dropped because the kernel said they changed
+};
+
+/**
+ * @brief Process-wide cache of generic netlink families, resolved with CTRL_CMD_GETFAMILY
+ *
+ * Generic netlink families get their IDs when they register, so every request to one has to be preceded by a
+ * lookup, which would double the round trips of a one-shot request. The cache asks the kernel once per family,
+ * the first time it is needed, and keeps the answer until the kernel says otherwise.
+ *
+ * The cache listens on the "notify" group of the nlctrl family, and a family that is unregistered or registered
+ * again (a module reload) is dropped and looked up afresh the next time. The notifications are read without
+ * waiting before each lookup, which costs a single non-blocking receive instead of a request and its reply. If
+ * notifications are lost to a receive queue overflow the whole cache is dropped.
+ *
+ * All of the methods are safe to call from any thread. Lookups that miss are made under a lock on the cache's own
+ * session, so they do not touch the session of the caller.
+ *
+ * @example
+ * @code
+ * uint16_t ethtool = genl_family_cache::instance().get_family_id(ETHTOOL_GENL_NAME);
+ * nl_msg message = netlink::thread_generic_session().init_genl_message(ethtool, ETHTOOL_MSG_LINKINFO_GET, ETHTOOL_GENL_VERSION, NLM_F_REQUEST);
+ * @endcode
+ */
+class genl_family_cache
+{
+public:
+    constexpr static const char* CTRL_NAME = "nlctrl";    ///< Name of the generic netlink controller family, GENL_ID_CTRL
+
+    /**
+     * @brief Get the cache shared by the whole process
+     */
+    static genl_family_cache& instance();
+
+    genl_family_cache();
+    ~genl_family_cache();
+
+    genl_family_cache(const genl_family_cache&) = delete;
+    genl_family_cache& operator=(const genl_family_cache&) = delete;
+
+    /**
+     * @brief Get a family, asking the kernel if it is not cached
+     *
+     * Throws a network_exception if the kernel does not have the family, for example because its module is not
+     * loaded. Failed lookups are not cached
+     *
+     * @param name  the name of the family, e.g. "ethtool"
+     * @return the family, which stays valid even if the cache drops it
+     */
+    std::shared_ptr<const genl_family> get(const std::string& name);
+
+    /**
+     * @brief Get the ID of a family to send requests to
+     *
+     * @see get
+     */
+    uint16_t get_family_id(const std::string& name);
+
+    /**
+     * @brief Get the ID of a multicast group of a family, for netlink::add_membership
+     *
+     * @see get
+     */
+    uint32_t get_group_id(const std::string& family, const std::string& group);
+
+    /**
+     * @brief Drop a family so the next lookup asks the kernel again
+     *
+     * Use this when a request to the family fails in a way that suggests its ID is stale
+     */
+    void invalidate(const std::string& name);
+
+    /**
+     * @brief Drop every family
+     */
+    void clear();
+
+    /**
+     * @brief Get the activity counters for this cache
+     *
+     * @return a copy of the counters
+     */
+    genl_cache_stats get_stats() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const genl_family>> families_;
+    std::unique_ptr<netlink> session_;
+    std::unique_ptr<netlink> monitor_;
+    genl_cache_stats stats_;
+
+    std::shared_ptr<const genl_family> resolve(const std::string& name);
+    void start_monitor();
+    void read_notifications();
+};
+
+} // end namespace fnc
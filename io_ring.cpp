@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#include "exceptions.hpp"
+#include "io_ring.hpp"
+#include "logging.hpp"
+
+namespace fnc
+{
+
+#ifdef IORING_RECV_MULTISHOT
+
+static const uint16_t BUFFER_GROUP = 0;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t arg_len)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_len);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+io_ring::io_ring(unsigned entries)
+    : ring_fd_(-1),
+      ring_(MAP_FAILED),
+      ring_len_(0),
+      sqes_(MAP_FAILED),
+      sqes_len_(0),
+      sq_entries_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_mask_(0),
+      sqe_tail_(0),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_mask_(0),
+      cqes_(nullptr),
+      buf_ring_(MAP_FAILED),
+      buf_ring_len_(0),
+      buf_count_(0),
+      buf_len_(0),
+      buf_tail_(0),
+      syscalls_(0)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    syscalls_++;
+    ring_fd_ = sys_io_uring_setup(entries, &params);
+    if (ring_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create io_uring: {}", strerror(errno));
+    }
+
+    // Waiting with a timeout needs IORING_FEAT_EXT_ARG (5.11), which also means the rings share one mapping
+    if ((params.features & IORING_FEAT_EXT_ARG) == 0 || (params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+    {
+        release();
+        THROW_NETEX("io_uring is missing required features=0x{:x}", params.features);
+    }
+
+    ring_len_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    syscalls_++;
+    ring_ = mmap(nullptr, ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ring_ == MAP_FAILED)
+    {
+        int mmap_errno = errno;
+        release();
+        THROW_NETEX("Failed to map io_uring: {}", strerror(mmap_errno));
+    }
+
+    sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    syscalls_++;
+    sqes_ = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED)
+    {
+        int mmap_errno = errno;
+        release();
+        THROW_NETEX("Failed to map io_uring SQEs: {}", strerror(mmap_errno));
+    }
+
+    char* ring = static_cast<char*>(ring_);
+    sq_entries_ = params.sq_entries;
+    sq_head_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+    sqe_tail_ = *sq_tail_;
+    cq_head_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+    cqes_ = ring + params.cq_off.cqes;
+
+    // SQE n always goes in slot n, so the indirection array only has to be filled in once
+    unsigned* sq_array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+    for (unsigned idx = 0; idx < sq_entries_; ++idx)
+    {
+        sq_array[idx] = idx;
+    }
+}
+
+io_ring::~io_ring()
+{
+    release();
+}
+
+void io_ring::release()
+{
+    unregister_buffers();
+    if (sqes_ != MAP_FAILED)
+    {
+        syscalls_++;
+        munmap(sqes_, sqes_len_);
+        sqes_ = MAP_FAILED;
+    }
+    if (ring_ != MAP_FAILED)
+    {
+        syscalls_++;
+        munmap(ring_, ring_len_);
+        ring_ = MAP_FAILED;
+    }
+    if (ring_fd_ >= 0)
+    {
+        // Closing the ring cancels anything that is still in flight
+        syscalls_++;
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+void* io_ring::get_sqe(int fd, uint8_t opcode, uint64_t user_data)
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_)
+    {
+        THROW_NETEX("io_uring submission queue is full");
+    }
+
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + (sqe_tail_ & sq_mask_);
+    sqe_tail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+void io_ring::prep_send(int fd, const void* buf, size_t len, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(get_sqe(fd, IORING_OP_SEND, user_data));
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+}
+
+void io_ring::prep_sendmsg(int fd, const struct msghdr* msg, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(get_sqe(fd, IORING_OP_SENDMSG, user_data));
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+}
+
+void io_ring::prep_recvmsg_multishot(int fd, const struct msghdr* msg, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(get_sqe(fd, IORING_OP_RECVMSG, user_data));
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+}
+
+void io_ring::prep_cancel(uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(get_sqe(-1, IORING_OP_ASYNC_CANCEL, user_data));
+    sqe->addr = target;
+}
+
+void io_ring::prep_poll(int fd, short events, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(get_sqe(fd, IORING_OP_POLL_ADD, user_data));
+    sqe->poll32_events = static_cast<uint16_t>(events);
+}
+
+bool io_ring::submit(unsigned wait_nr, std::chrono::milliseconds timeout)
+{
+    unsigned to_submit = sqe_tail_ - *sq_tail_;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        unsigned flags = 0;
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec wait_time;
+        if (wait_nr > 0)
+        {
+            flags |= IORING_ENTER_GETEVENTS;
+            if (timeout.count() >= 0)
+            {
+                auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+                if (remaining.count() <= 0)
+                {
+                    return false;
+                }
+                wait_time.tv_sec = remaining.count() / 1000000000;
+                wait_time.tv_nsec = remaining.count() % 1000000000;
+                memset(&arg, 0, sizeof(arg));
+                arg.sigmask_sz = _NSIG / 8;
+                arg.ts = reinterpret_cast<uint64_t>(&wait_time);
+                flags |= IORING_ENTER_EXT_ARG;
+            }
+        }
+
+        syscalls_++;
+        int rc = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags, (flags & IORING_ENTER_EXT_ARG) ? &arg : nullptr, sizeof(arg));
+        if (rc < 0 && errno != EINTR)
+        {
+            if (errno == ETIME)
+            {
+                return false;
+            }
+            THROW_NETEX("Failed to submit to io_uring: {}", strerror(errno));
+        }
+        if (rc > 0)
+        {
+            to_submit -= std::min<unsigned>(rc, to_submit);
+        }
+
+        // The call returns as soon as it has submitted something, without waiting, so keep going until the
+        // completions are actually there
+        unsigned ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+        if (to_submit == 0 && ready >= wait_nr)
+        {
+            return true;
+        }
+    }
+}
+
+bool io_ring::next_completion(io_completion& completion)
+{
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    const struct io_uring_cqe* cqe = static_cast<struct io_uring_cqe*>(cqes_) + (head & cq_mask_);
+    completion.user_data = cqe->user_data;
+    completion.res = cqe->res;
+    completion.more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    completion.has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    completion.buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void io_ring::register_buffers(unsigned count, size_t buffer_len)
+{
+    unregister_buffers();
+
+    buf_ring_len_ = count * sizeof(struct io_uring_buf);
+    syscalls_++;
+    buf_ring_ = mmap(nullptr, buf_ring_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring_ == MAP_FAILED)
+    {
+        THROW_NETEX("Failed to allocate io_uring buffer ring: {}", strerror(errno));
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = count;
+    reg.bgid = BUFFER_GROUP;
+    syscalls_++;
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        int register_errno = errno;
+        syscalls_++;
+        munmap(buf_ring_, buf_ring_len_);
+        buf_ring_ = MAP_FAILED;
+        THROW_NETEX("Failed to register io_uring buffer ring: {}", strerror(register_errno));
+    }
+
+    buf_count_ = count;
+    buf_len_ = buffer_len;
+    buf_tail_ = 0;
+    buffers_.resize(count * get_buffer_stride());
+    for (unsigned idx = 0; idx < count; ++idx)
+    {
+        add_buffer(idx);
+    }
+    __atomic_store_n(&static_cast<struct io_uring_buf_ring*>(buf_ring_)->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+void io_ring::unregister_buffers()
+{
+    if (buf_ring_ == MAP_FAILED)
+    {
+        return;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = BUFFER_GROUP;
+    syscalls_++;
+    if (sys_io_uring_register(ring_fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        LOG_DEBUG("Failed to unregister io_uring buffer ring: {}", strerror(errno));
+    }
+    syscalls_++;
+    munmap(buf_ring_, buf_ring_len_);
+    buf_ring_ = MAP_FAILED;
+}
+
+size_t io_ring::get_buffer_len() const
+{
+    return buf_len_;
+}
+
+unsigned io_ring::get_buffer_count() const
+{
+    return buf_count_;
+}
+
+size_t io_ring::get_buffer_stride() const
+{
+    // Each buffer also has to hold the header the kernel puts in front of the datagram
+    return buf_len_ + sizeof(struct io_uring_recvmsg_out);
+}
+
+io_received io_ring::get_received(const io_completion& completion)
+{
+    // The buffer starts with a header describing the message, then the address and control data we did not ask for
+    char* buffer = buffers_.data() + completion.buffer_id * get_buffer_stride();
+    const struct io_uring_recvmsg_out* out = reinterpret_cast<struct io_uring_recvmsg_out*>(buffer);
+    size_t offset = sizeof(*out) + out->namelen + out->controllen;
+
+    io_received received;
+    received.data = buffer + offset;
+    received.len = completion.res > 0 ? completion.res - offset : 0;
+    received.full_len = (out->flags & MSG_TRUNC) ? out->payloadlen : received.len;
+    return received;
+}
+
+void io_ring::recycle_buffer(uint16_t buffer_id)
+{
+    add_buffer(buffer_id);
+    __atomic_store_n(&static_cast<struct io_uring_buf_ring*>(buf_ring_)->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+void io_ring::add_buffer(uint16_t buffer_id)
+{
+    // The ring tail shares memory with the first entry, so only the fields of the entry are written
+    struct io_uring_buf* buf = &static_cast<struct io_uring_buf_ring*>(buf_ring_)->bufs[buf_tail_ & (buf_count_ - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(buffers_.data() + buffer_id * get_buffer_stride());
+    buf->len = get_buffer_stride();
+    buf->bid = buffer_id;
+    buf_tail_++;
+}
+
+uint64_t io_ring::get_syscalls() const
+{
+    return syscalls_;
+}
+
+#else // IORING_RECV_MULTISHOT
+
+//
+// The kernel headers are too old for multishot receive, so there is never a usable ring
+//
+
+io_ring::io_ring(unsigned)
+    : ring_fd_(-1),
+      ring_(nullptr),
+      ring_len_(0),
+      sqes_(nullptr),
+      sqes_len_(0),
+      sq_entries_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_mask_(0),
+      sqe_tail_(0),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_mask_(0),
+      cqes_(nullptr),
+      buf_ring_(nullptr),
+      buf_ring_len_(0),
+      buf_count_(0),
+      buf_len_(0),
+      buf_tail_(0),
+      syscalls_(0)
+{
+    THROW_NETEX("io_uring multishot receive is not supported by the kernel headers this was built with");
+}
+
+io_ring::~io_ring() { }
+void io_ring::release() { }
+void* io_ring::get_sqe(int, uint8_t, uint64_t) { return nullptr; }
+void io_ring::prep_send(int, const void*, size_t, uint64_t) { }
+void io_ring::prep_sendmsg(int, const struct msghdr*, uint64_t) { }
+void io_ring::prep_recvmsg_multishot(int, const struct msghdr*, uint64_t) { }
+void io_ring::prep_cancel(uint64_t, uint64_t) { }
+void io_ring::prep_poll(int, short, uint64_t) { }
+bool io_ring::submit(unsigned, std::chrono::milliseconds) { return false; }
+bool io_ring::next_completion(io_completion&) { return false; }
+void io_ring::register_buffers(unsigned, size_t) { }
+void io_ring::unregister_buffers() { }
+size_t io_ring::get_buffer_len() const { return 0; }
+unsigned io_ring::get_buffer_count() const { return 0; }
+size_t io_ring::get_buffer_stride() const { return 0; }
+io_received io_ring::get_received(const io_completion&) { return io_received { nullptr, 0, 0 }; }
+void io_ring::recycle_buffer(uint16_t) { }
+void io_ring::add_buffer(uint16_t) { }
+uint64_t io_ring::get_syscalls() const { return 0; }
+
+#endif // IORING_RECV_MULTISHOT
+
+} // end namespace fnc
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <vector>
+
+namespace fnc
+{
+
+/**
+ * @brief A completion read from an io_ring
+ */
+struct io_completion
+{
+    uint64_t user_data;     ///< The user_data of the request that completed
+    int32_t res;            ///< The result of the request, a negative errno value on failure
+    bool more;              ///< The request is multishot and is still armed
+    bool has_buffer;        ///< A provided buffer was used, see buffer_id
+    uint16_t buffer_id;     ///< The provided buffer that holds the received data
+};
+
+/**
+ * @brief A datagram received into a provided buffer by a multishot recvmsg
+ */
+struct io_received
+{
+    char* data;             ///< Start of the datagram
+    size_t len;             ///< Bytes of the datagram that fit in the buffer
+    size_t full_len;        ///< Size of the whole datagram, larger than len if it was truncated
+};
+
+/**
+ * @brief Minimal io_uring instance for socket I/O
+ *
+ * This talks to the kernel with the raw io_uring syscalls so there is no dependency on liburing, and only supports
+ * what netlink needs - sends, a multishot recvmsg into one ring of provided buffers, polls, cancellation, and
+ * waiting for completions with a timeout. Multishot receive needs kernel headers and a kernel from 6.0 or newer;
+ * when the headers are too old the constructor always throws. It is not thread safe.
+ */
+class io_ring
+{
+public:
+    /**
+     * Constructor
+     *
+     * Throws a network_exception if io_uring is not available, e.g. on an old kernel or when it is blocked by seccomp
+     *
+     * @param entries   the number of submission queue entries
+     */
+    io_ring(unsigned entries);
+    virtual ~io_ring();
+
+    io_ring(const io_ring&) = delete;
+    io_ring& operator=(const io_ring&) = delete;
+
+    /**
+     * @brief Queue a send of a buffer on a socket
+     */
+    void prep_send(int fd, const void* buf, size_t len, uint64_t user_data);
+
+    /**
+     * @brief Queue a sendmsg on a socket
+     */
+    void prep_sendmsg(int fd, const struct msghdr* msg, uint64_t user_data);
+
+    /**
+     * @brief Queue a multishot recvmsg on a socket that receives each datagram into one of the provided buffers
+     *
+     * The receive stays armed and produces a completion for every datagram until it fails or is cancelled.
+     * msg must stay valid until the final completion and must not ask for an address or control data.
+     */
+    void prep_recvmsg_multishot(int fd, const struct msghdr* msg, uint64_t user_data);
+
+    /**
+     * @brief Queue a cancellation of the request with the given user_data
+     */
+    void prep_cancel(uint64_t target, uint64_t user_data);
+
+    /**
+     * @brief Queue a one shot poll that completes when a file descriptor has any of the given events, e.g. POLLIN
+     */
+    void prep_poll(int fd, short events, uint64_t user_data);
+
+    /**
+     * @brief Submit the queued requests and optionally wait for completions
+     *
+     * @param wait_nr   the number of unread completions to wait for
+     * @param timeout   how long to wait, negative to wait forever
+     * @return false if the timeout expired first
+     */
+    bool submit(unsigned wait_nr = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+    /**
+     * @brief Read the next completion without waiting
+     *
+     * @param completion    filled in with the completion
+     * @return false if there are no completions
+     */
+    bool next_completion(io_completion& completion);
+
+    /**
+     * @brief Hand a set of receive buffers to the kernel for prep_recvmsg_multishot
+     *
+     * Replaces any buffers that were registered before, so nothing may be using them
+     *
+     * @param count         the number of buffers, a power of two
+     * @param buffer_len    the largest datagram each buffer can hold
+     */
+    void register_buffers(unsigned count, size_t buffer_len);
+
+    /**
+     * @brief Get the largest datagram each registered buffer can hold
+     */
+    size_t get_buffer_len() const;
+
+    /**
+     * @brief Get the number of registered buffers
+     */
+    unsigned get_buffer_count() const;
+
+    /**
+     * @brief Get the datagram that a multishot recvmsg completion received
+     *
+     * The buffer belongs to the caller until it is handed back with recycle_buffer
+     */
+    io_received get_received(const io_completion& completion);
+
+    /**
+     * @brief Give a provided buffer back to the kernel
+     */
+    void recycle_buffer(uint16_t buffer_id);
+
+    /**
+     * @brief Get the number of syscalls made by this ring, including its setup
+     */
+    uint64_t get_syscalls() const;
+
+private:
+    int ring_fd_;
+    void* ring_;
+    size_t ring_len_;
+    void* sqes_;
+    size_t sqes_len_;
+    unsigned sq_entries_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sqe_tail_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    void* cqes_;
+    void* buf_ring_;
+    size_t buf_ring_len_;
+    unsigned buf_count_;
+    size_t buf_len_;
+    uint16_t buf_tail_;
+    std::vector<char> buffers_;
+    uint64_t syscalls_;
+
+    void* get_sqe(int fd, uint8_t opcode, uint64_t user_data);
+    size_t get_buffer_stride() const;
+    void add_buffer(uint16_t buffer_id);
+    void unregister_buffers();
+    void release();
+};
+
+} // end namespace fnc
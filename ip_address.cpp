@@ -1,6 +1,7 @@
 #include <boost/asio/ip/address.hpp>
 #include <boost/system/error_code.hpp>
 #include <ostream>
+#include <string.h>
 
 #include "exceptions.hpp"
 #include "ip_address.hpp"
@@ -19,8 +20,43 @@ const ip_address ip_address::UNSPECIFIED;
 ip_address::ip_address()  : boost::asio::ip::address() { }
 #endif
 
+/**
+ * @brief Convert the bytes of an address in network order to a boost address
+ */
+static boost::asio::ip::address address_from_bytes(int family, const void* addr)
+{
+    if (family == AF_INET)
+    {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        memcpy(bytes.data(), addr, bytes.size());
+        return boost::asio::ip::address_v4(bytes);
+    }
+    if (family == AF_INET6)
+    {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        memcpy(bytes.data(), addr, bytes.size());
+        return boost::asio::ip::address_v6(bytes);
+    }
+    THROWEX(illegal_argument, "Invalid IP address family={}", family);
+}
+
 ip_address::ip_address(const std::string &address, int prefix)
 try : boost::asio::ip::address(boost::asio::ip::address::from_string(address))
+{
+    init(prefix);
+}
+catch (boost::system::system_error&)
+{
+    THROWEX(illegal_argument, "Invalid IP address");
+}
+
+ip_address::ip_address(int family, const void* addr, int prefix)
+    : boost::asio::ip::address(address_from_bytes(family, addr))
+{
+    init(prefix);
+}
+
+void ip_address::init(int prefix)
 {
     prefix_ = prefix;
     if (prefix_ < 0)
@@ -36,10 +72,6 @@ try : boost::asio::ip::address(boost::asio::ip::address::from_string(address))
         scope_ = ip_address_scope::host;
     }
 }
-catch (boost::system::system_error&)
-{
-    THROWEX(illegal_argument, "Invalid IP address");
-}
 
 ip_address::ip_address(const char *address, int prefix)
     : ip_address(std::string(address), prefix)
@@ -33,6 +33,15 @@ public:
     ip_address(const char* address, int prefix = -1);
     ip_address(const sockaddr_in* addr, int prefix = -1);
 
+    /**
+     * @brief Create an address from its bytes in network order, e.g. from a netlink attribute
+     *
+     * @param family    AF_INET or AF_INET6
+     * @param addr      4 or 16 bytes depending on family
+     * @param prefix    prefix length, or -1 for the default
+     */
+    ip_address(int family, const void* addr, int prefix = -1);
+
     friend bool operator==(const ip_address& lhs, const ip_address& rhs);
     friend bool operator!=(const ip_address& lhs, const ip_address& rhs);
 
@@ -53,6 +62,8 @@ public:
 private:
     int prefix_ = -1;
     ip_address_scope scope_ = ip_address_scope::global;
+
+    void init(int prefix);
 };
 
 } // end namespace fnc
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+#include "link_cache.hpp"
+#include "logging.hpp"
+
+namespace fnc
+{
+
+link_cache& link_cache::instance()
+{
+    static link_cache cache;
+    return cache;
+}
+
+link_cache::link_cache()
+    : wake_fd_(-1),
+      stopping_(false),
+      lookups_(0),
+      updates_(0),
+      resyncs_(0)
+{
+    // Listen before dumping, so a change made while the dump is running is not missed
+    monitor_.set_nonblocking();
+    monitor_.add_membership(RTNLGRP_LINK);
+    load();
+
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create link cache wake event: {}", strerror(errno));
+    }
+    listener_ = std::thread([this] { run(); });
+}
+
+link_cache::~link_cache()
+{
+    stopping_.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0)
+    {
+        LOG_WARN("Failed to wake link cache listener: {}", strerror(errno));
+    }
+    listener_.join();
+    close(wake_fd_);
+}
+
+std::optional<link_info> link_cache::get(iface_idx_t index) const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = links_.find(index);
+    if (it == links_.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::optional<link_info> link_cache::get(const std::string& name) const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = names_.find(name);
+    if (it == names_.end())
+    {
+        return std::nullopt;
+    }
+    return links_.at(it->second);
+}
+
+std::vector<link_info> link_cache::get_all() const
+{
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<link_info> links;
+    links.reserve(links_.size());
+    for (const auto& entry : links_)
+    {
+        links.push_back(entry.second);
+    }
+    return links;
+}
+
+void link_cache::resync()
+{
+    load();
+    resyncs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+link_cache_stats link_cache::get_stats() const
+{
+    link_cache_stats stats;
+    stats.lookups = lookups_.load(std::memory_order_relaxed);
+    stats.updates = updates_.load(std::memory_order_relaxed);
+    stats.resyncs = resyncs_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void link_cache::load()
+{
+    // A session of its own, so the replies to the dump never mix with the notifications
+    netlink nl;
+    std::unordered_map<iface_idx_t, link_info> links;
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    nl.send_dump_sync(message, [&]{ links.clear(); }, [&](struct nlmsghdr* msg_ptr) {
+        link_info info;
+        if (parse_link_info(msg_ptr, info))
+        {
+            links[info.index] = std::move(info);
+        }
+    });
+
+    std::unordered_map<std::string, iface_idx_t> names;
+    for (const auto& entry : links)
+    {
+        names[entry.second.name] = entry.first;
+    }
+    LOG_DEBUG("Loaded {} links into the link cache", links.size());
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    links_.swap(links);
+    names_.swap(names);
+}
+
+void link_cache::run()
+{
+    while (!stopping_.load(std::memory_order_acquire))
+    {
+        struct pollfd fds[2];
+        fds[0].fd = monitor_.get_fd();
+        fds[0].events = POLLIN;
+        fds[1].fd = wake_fd_;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            LOG_WARN("Stopped listening for link changes, the link cache will not be updated: {}", strerror(errno));
+            return;
+        }
+
+        try
+        {
+            while (monitor_.receive_available([this](struct nlmsghdr* msg_ptr) { apply(msg_ptr); }))
+            { }
+        }
+        catch (const inconsistent_dump&)
+        {
+            // Some notifications were lost, so the only way to know what changed is to look at everything again
+            LOG_DEBUG("Lost link notifications, dumping the links again");
+            try
+            {
+                resync();
+            }
+            catch (const fnc_exception& ex)
+            {
+                LOG_WARN("Failed to dump the links again, the link cache may be out of date: {}", ex.message);
+            }
+        }
+        catch (const fnc_exception& ex)
+        {
+            LOG_WARN("Stopped listening for link changes, the link cache will not be updated: {}", ex.message);
+            return;
+        }
+    }
+}
+
+void link_cache::apply(struct nlmsghdr* msg_ptr)
+{
+    if ((msg_ptr->nlmsg_type != RTM_NEWLINK && msg_ptr->nlmsg_type != RTM_DELLINK) ||
+        msg_ptr->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+    {
+        return;
+    }
+
+    // Bridges also announce their ports with AF_BRIDGE messages, and a port leaving a bridge is still a link
+    const struct ifinfomsg* ifinfo = static_cast<const struct ifinfomsg*>(NLMSG_DATA(msg_ptr));
+    if (ifinfo->ifi_family != AF_UNSPEC)
+    {
+        return;
+    }
+    link_info info;
+    bool deleted = msg_ptr->nlmsg_type == RTM_DELLINK;
+    if (!deleted && !parse_link_info(msg_ptr, info))
+    {
+        return;
+    }
+    updates_.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto existing = links_.find(ifinfo->ifi_index);
+    if (existing != links_.end())
+    {
+        // The link may have been renamed, and another link may have taken its old name since
+        auto name = names_.find(existing->second.name);
+        if (name != names_.end() && name->second == ifinfo->ifi_index)
+        {
+            names_.erase(name);
+        }
+        if (deleted)
+        {
+            links_.erase(existing);
+        }
+    }
+    if (!deleted)
+    {
+        names_[info.name] = info.index;
+        links_[info.index] = std::move(info);
+    }
+}
+
+} // end namespace fnc
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "netiface.hpp"
+#include "netlink.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Counters for the activity of a link_cache
+ */
+struct link_cache_stats
+{
+    uint64_t lookups = 0;           ///< Number of lookups answered, whether the link was found or not
+    uint64_t updates = 0;           ///< Number of link notifications applied
+    uint64_t resyncs = 0;           ///< Number of times the table was dumped again, after the first
+};
+
+/**
+ * @brief Table of every link on the host, kept current by RTNLGRP_LINK notifications
+ *
+ * The table is filled with one dump, and a listener thread applies the notifications the kernel sends when a
+ * link is created, changed, renamed or deleted. Lookups by index or by name only take a shared lock and copy the
+ * entry out, so they never go to the kernel. If notifications are lost to a receive queue overflow, the table is
+ * dumped again, and the notifications that arrive meanwhile are applied after it so the newest state wins.
+ *
+ * The table follows the kernel instead of being part of it, so a change shows up shortly after the request that
+ * made it has returned. Use netiface::get_link_info to read a link as it is right now.
+ *
+ * All of the methods are safe to call from any thread.
+ *
+ * @example
+ * @code
+ * netiface eth0("eth0");
+ * eth0.use_link_cache(&link_cache::instance());
+ * mtu_t mtu = eth0.get_mtu();
+ * @endcode
+ */
+class link_cache
+{
+public:
+    /**
+     * @brief Get the cache shared by the whole process, which is filled the first time it is used
+     */
+    static link_cache& instance();
+
+    /**
+     * Constructor, which dumps the links and starts the listener thread
+     */
+    link_cache();
+
+    /**
+     * Destructor, which stops the listener thread
+     */
+    virtual ~link_cache();
+
+    link_cache(const link_cache&) = delete;
+    link_cache& operator=(const link_cache&) = delete;
+
+    /**
+     * @brief Get a link by index
+     *
+     * @return the link, or nothing if there is no link with the index
+     */
+    std::optional<link_info> get(iface_idx_t index) const;
+
+    /**
+     * @brief Get a link by name
+     *
+     * @return the link, or nothing if there is no link with the name
+     */
+    std::optional<link_info> get(const std::string& name) const;
+
+    /**
+     * @brief Get every link, in no particular order
+     */
+    std::vector<link_info> get_all() const;
+
+    /**
+     * @brief Dump the links again and replace the table
+     */
+    void resync();
+
+    /**
+     * @brief Get the activity counters for this cache
+     *
+     * @return a copy of the counters
+     */
+    link_cache_stats get_stats() const;
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<iface_idx_t, link_info> links_;
+    std::unordered_map<std::string, iface_idx_t> names_;
+    netlink monitor_;
+    int wake_fd_;
+    std::atomic<bool> stopping_;
+    mutable std::atomic<uint64_t> lookups_;
+    std::atomic<uint64_t> updates_;
+    std::atomic<uint64_t> resyncs_;
+    std::thread listener_;
+
+    void load();
+    void run();
+    void apply(struct nlmsghdr* msg_ptr);
+};
+
+} // end namespace fnc
@@ -29,7 +29,7 @@ mac_address::mac_address()
     : address_(0)
 { }
 
-mac_address::mac_address(uint8_t* addr)
+mac_address::mac_address(const uint8_t* addr)
 {
     address_ = 0;
     int shift = 40;
@@ -11,7 +11,7 @@ class mac_address
 public:
 
     mac_address();
-    mac_address(uint8_t* addr);
+    mac_address(const uint8_t* addr);
     mac_address(const std::string& addr);
 
     std::string to_string() const;
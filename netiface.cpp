@@ -13,9 +13,12 @@
 #include <unistd.h>
 
 #include "netiface.hpp"
+#include "address_cache.hpp"
 #include "exceptions.hpp"
+#include "link_cache.hpp"
 #include "logging.hpp"
 #include "netlink.hpp"
+#include "netlink_attrs.hpp"
 #include "util/container_util.hpp"
 #include "util/mac_helper.hpp"
 #include "util/scope_exit.hpp"
@@ -30,46 +33,421 @@ std::ostream& operator << (std::ostream& os, const ip_family_type& obj)
    return os;
 }
 
-std::vector<std::string> netiface::get_iface_names()
+//
+// The message helpers below work on both a single nl_msg and a netlink_builder batch
+//
+
+/**
+ * @brief Append an IFA_LOCAL attribute with the given address to an address message
+ */
+template <typename Message>
+static void add_local_address(Message& message, ip_address address)
 {
-    std::vector<std::string> iface_names;
+    if (address.is_v4())
+    {
+        struct sockaddr_in addr = address.to_sockaddr_in();
+        message.add_attr(IFA_LOCAL, &addr.sin_addr, sizeof(addr.sin_addr));
+    }
+    else if (address.is_v6())
+    {
+        struct sockaddr_in6 addr = address.to_sockaddr_in6();
+        message.add_attr(IFA_LOCAL, &addr.sin6_addr, sizeof(addr.sin6_addr));
+    }
+}
 
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
-    nl.send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
-        if (msg_ptr->nlmsg_type != RTM_NEWLINK)
+/**
+ * @brief Fill in an RTM_NEWADDR/RTM_DELADDR message for an address on an interface
+ */
+template <typename Message>
+static void init_address_message(Message& message, iface_idx_t iface_idx, ip_address address, int prefix)
+{
+    struct ifaddrmsg* ifaddr = message.template get_header<struct ifaddrmsg>();
+    ifaddr->ifa_index = iface_idx;
+    ifaddr->ifa_prefixlen = prefix;
+    ifaddr->ifa_scope = address.get_scope();
+    ifaddr->ifa_family = address.is_v4() ? AF_INET : AF_INET6;
+    add_local_address(message, address);
+}
+
+/**
+ * @brief Fill in an RTM_NEWLINK message that sets the MTU of an interface
+ */
+template <typename Message>
+static void init_mtu_message(Message& message, iface_idx_t iface_idx, mtu_t mtu)
+{
+    struct ifinfomsg* ifinfo = message.template get_header<struct ifinfomsg>();
+    ifinfo->ifi_index = iface_idx;
+    ifinfo->ifi_change = 0xFFFFFFFF;
+    message.add_attr(IFLA_MTU, &mtu, sizeof(mtu));
+}
+
+/**
+ * @brief Fill in an RTM_GETLINK request for a single link, by name
+ *
+ * Asking for one link instead of dumping them all and picking it out works on every kernel, and the cost does not
+ * grow with the number of links on the host
+ */
+template <typename Message>
+static void init_link_name_request(Message& message, const std::string& name)
+{
+    message.add_string(IFLA_IFNAME, name);
+}
+
+/**
+ * @brief Fill in an RTM_GETADDR dump request for the addresses of one interface
+ *
+ * The kernel only returns the requested family, and with NETLINK_GET_STRICT_CHK only the requested interface.
+ * Older kernels send the addresses of every interface, so the replies still have to be filtered
+ */
+static void init_address_dump(nl_msg& message, iface_idx_t iface_idx, const ip_family_type& ip_family)
+{
+    struct ifaddrmsg* ifaddr = message.get_header<struct ifaddrmsg>();
+    ifaddr->ifa_index = iface_idx;
+    if (ip_family == ip_family_type::v4)
+    {
+        ifaddr->ifa_family = AF_INET;
+    }
+    else if (ip_family == ip_family_type::v6)
+    {
+        ifaddr->ifa_family = AF_INET6;
+    }
+    else
+    {
+        ifaddr->ifa_family = AF_UNSPEC;
+    }
+}
+
+/**
+ * @brief The fields of an RTM_NEWLINK message that netiface uses
+ *
+ * The views point into the received message and are only valid inside the reply callback
+ */
+struct link_view
+{
+    iface_idx_t index = -1;
+    unsigned flags = 0;
+    std::string_view name;
+    mtu_t mtu = 0;
+    attr_bytes address;
+    uint8_t operstate = 0;
+    uint32_t txqueuelen = 0;
+};
+
+/**
+ * @brief The fields of an RTM_NEWADDR message that netiface uses
+ */
+struct address_view
+{
+    iface_idx_t index = -1;
+    int family = AF_UNSPEC;
+    int prefix = -1;
+    attr_bytes address;
+};
+
+/**
+ * @brief Parse an RTM_NEWLINK message in one pass over its attributes
+ *
+ * @return false if it is some other kind of message
+ */
+static bool parse_link(struct nlmsghdr* msg_ptr, link_view& link)
+{
+    if (msg_ptr->nlmsg_type != RTM_NEWLINK)
+    {
+        LOG_WARN("Recieved unknown message type {}", msg_ptr->nlmsg_type);
+        return false;
+    }
+
+    struct ifinfomsg* iface_info = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(msg_ptr));
+    attr_table<IFLA_MAX> attrs(IFLA_RTA(iface_info), msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*iface_info)));
+    link.index = iface_info->ifi_index;
+    link.flags = iface_info->ifi_flags;
+    link.name = attrs.get_string(IFLA_IFNAME);
+    attrs.get(IFLA_MTU, link.mtu);
+    link.address = attrs.get_bytes(IFLA_ADDRESS);
+    attrs.get(IFLA_OPERSTATE, link.operstate);
+    attrs.get(IFLA_TXQLEN, link.txqueuelen);
+    return true;
+}
+
+/**
+ * @brief Copy the fields of a parsed RTM_NEWLINK message out of the message
+ */
+static link_info make_link_info(const link_view& link)
+{
+    link_info info;
+    info.index = link.index;
+    info.name = std::string(link.name);
+    info.mtu = link.mtu;
+    if (link.address.len >= IFHWADDRLEN)
+    {
+        info.mac = mac_address(link.address.data);
+    }
+    info.flags = link.flags;
+    info.operstate = static_cast<oper_state>(link.operstate);
+    info.txqueuelen = link.txqueuelen;
+    return info;
+}
+
+bool parse_link_info(struct nlmsghdr* msg_ptr, link_info& info)
+{
+    link_view link;
+    if (!parse_link(msg_ptr, link))
+    {
+        return false;
+    }
+    info = make_link_info(link);
+    return true;
+}
+
+/**
+ * @brief Parse an RTM_NEWADDR message, or the RTM_DELADDR echo of a delete, in one pass over its attributes
+ *
+ * @return false if it is some other kind of message
+ */
+static bool parse_address(struct nlmsghdr* msg_ptr, address_view& address, uint16_t nlmsg_type = RTM_NEWADDR)
+{
+    if (msg_ptr->nlmsg_type != nlmsg_type)
+    {
+        LOG_INFO("Recieved unknown message type {}", msg_ptr->nlmsg_type);
+        return false;
+    }
+
+    struct ifaddrmsg* addr_info = reinterpret_cast<struct ifaddrmsg*>(NLMSG_DATA(msg_ptr));
+    attr_table<IFA_MAX> attrs(IFA_RTA(addr_info), msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*addr_info)));
+    address.index = addr_info->ifa_index;
+    address.family = addr_info->ifa_family;
+    address.prefix = addr_info->ifa_prefixlen;
+    address.address = attrs.get_bytes(IFA_ADDRESS);
+    return true;
+}
+
+/**
+ * @brief Get the index of the link described by an RTM_NEWLINK message if it has the given name
+ *
+ * @return the index of the link, or -1 if it is some other link
+ */
+static iface_idx_t match_link_name(struct nlmsghdr* msg_ptr, const std::string& name)
+{
+    link_view link;
+    if (!parse_link(msg_ptr, link) || link.name != name)
+    {
+        return -1;
+    }
+    return link.index;
+}
+
+/**
+ * @brief Add the address described by an RTM_NEWADDR message to a list, if it belongs to the given interface
+ */
+static void add_address(struct nlmsghdr* msg_ptr,
+                        iface_idx_t iface_idx,
+                        const ip_family_type& ip_family,
+                        bool include_prefix,
+                        std::vector<ip_address>& addresses)
+{
+    bool get_v4 = (ip_family & ip_family_type::v4) == ip_family_type::v4;
+    bool get_v6 = (ip_family & ip_family_type::v6) == ip_family_type::v6;
+
+    address_view address;
+    if (!parse_address(msg_ptr, address) || address.index != iface_idx)
+    {
+        return;
+    }
+    if ((address.family == AF_INET && !get_v4) || (address.family == AF_INET6 && !get_v6))
+    {
+        return;
+    }
+    size_t addr_len = address.family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    if (address.address.len < addr_len)
+    {
+        return;
+    }
+    addresses.emplace_back(address.family, address.address.data, include_prefix ? address.prefix : -1);
+}
+
+std::optional<ip_address> parse_address_info(struct nlmsghdr* msg_ptr, iface_idx_t& index)
+{
+    address_view address;
+    if ((msg_ptr->nlmsg_type != RTM_NEWADDR && msg_ptr->nlmsg_type != RTM_DELADDR) ||
+        !parse_address(msg_ptr, address, msg_ptr->nlmsg_type))
+    {
+        return std::nullopt;
+    }
+    if (address.family != AF_INET && address.family != AF_INET6)
+    {
+        return std::nullopt;
+    }
+    size_t addr_len = address.family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    if (address.address.len < addr_len)
+    {
+        return std::nullopt;
+    }
+    index = address.index;
+    return ip_address(address.family, address.address.data, address.prefix);
+}
+
+/**
+ * @brief Check if an address is in a list, ignoring the prefix of IPv4 addresses
+ *
+ * IPv4 addresses are deleted with a /32 prefix, so the prefix they were added with does not matter
+ */
+static bool contains_for_delete(const std::vector<ip_address>& addresses, const ip_address& address)
+{
+    if (address.is_v4())
+    {
+        return contains(addresses, address, [&address](const auto& item) { return item.without_prefix() == address.without_prefix(); });
+    }
+    return contains(addresses, address);
+}
+
+/**
+ * @brief Check if a reply is the kernel echoing an address change back to a request with NLM_F_ECHO
+ *
+ * The echo comes before the ACK, so once the request returns it has either arrived or is not coming. Kernels echo
+ * IPv4 address changes, while IPv6 ones are announced later by duplicate address detection and still have to be
+ * looked for
+ */
+static bool is_address_echo(struct nlmsghdr* msg_ptr, uint16_t nlmsg_type, iface_idx_t iface_idx, const ip_address& address)
+{
+    address_view echo;
+    if (msg_ptr->nlmsg_type != nlmsg_type || !parse_address(msg_ptr, echo, nlmsg_type) || echo.index != iface_idx)
+    {
+        return false;
+    }
+    size_t addr_len = echo.family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    if (echo.address.len < addr_len)
+    {
+        return false;
+    }
+    ip_address echoed(echo.family, echo.address.data, echo.prefix);
+    if (nlmsg_type == RTM_DELADDR)
+    {
+        return contains_for_delete({ echoed }, address);
+    }
+    return echoed == address;
+}
+
+/**
+ * @brief Check if a reply is the kernel echoing a link back to a request with NLM_F_ECHO, with the given MTU
+ *
+ * Kernels only echo links they create, so a change to an existing link still has to be looked for
+ */
+static bool is_mtu_echo(struct nlmsghdr* msg_ptr, iface_idx_t iface_idx, mtu_t mtu)
+{
+    link_view link;
+    return msg_ptr->nlmsg_type == RTM_NEWLINK && parse_link(msg_ptr, link) && link.index == iface_idx && link.mtu == mtu;
+}
+
+/**
+ * @brief Get how long to wait for a change to show up on an interface, cut short by the deadline of the operation
+ */
+static std::chrono::milliseconds settle_time(netlink& nl, std::chrono::milliseconds max_settle_time)
+{
+    deadline limit = nl.get_deadline();
+    return limit.is_never() ? max_settle_time : std::min(max_settle_time, limit.remaining());
+}
+
+/**
+ * @brief Wait for the notification of a change, or failing that for the change to show up when looked for
+ *
+ * The kernel queues the notification for a change before it sends the ACK for the request, so it is usually
+ * already waiting once the request returns. A request that changes nothing, like setting the MTU the link already
+ * has, is not announced, so the change is looked for once before waiting, and once more when the time is up. If
+ * notifications are lost to a queue overflow, or there is no socket to listen on, it is looked for until it shows up
+ *
+ * @param monitor           a socket that joined the groups the change is announced to before the request was sent,
+ *                          or nullptr
+ * @param timeout           how long to wait
+ * @param timeout_message   message to use in the exception if the change does not show up
+ * @param matches           called with each notification, returns true once the change has been announced
+ * @param check             looks for the change, returns true if it is there
+ */
+template <typename Matcher, typename Check>
+static void confirm_change(netlink* monitor,
+                           std::chrono::milliseconds timeout,
+                           const std::string& timeout_message,
+                           Matcher matches,
+                           Check check)
+{
+    if (!monitor)
+    {
+        WaitFor(timeout, timeout_message, check);
+        return;
+    }
+
+    deadline limit = deadline::after(timeout);
+    bool confirmed = false;
+    auto on_message = [&](struct nlmsghdr* msg_ptr) {
+        confirmed = confirmed || matches(msg_ptr);
+    };
+    try
+    {
+        while (!confirmed && monitor->receive_available(on_message))
+        { }
+        if (confirmed || check())
         {
-            LOG_WARN("Recieved unknown message type {}", msg_ptr->nlmsg_type);
             return;
         }
+        while (!confirmed && monitor->receive_until(on_message, limit))
+        { }
+    }
+    catch (const inconsistent_dump&)
+    {
+        LOG_DEBUG("Lost notifications while waiting for a change, looking for it instead");
+        WaitFor(limit.remaining(), timeout_message, check);
+        return;
+    }
+    if (!confirmed && !check())
+    {
+        THROW_TIMEOUT(timeout_message);
+    }
+}
+
+/**
+ * @brief Wait for the notification of an address change to reach an address cache, so it can be read back from it
+ */
+static void confirm_cached(const address_cache& cache,
+                           iface_idx_t iface_idx,
+                           std::chrono::milliseconds timeout,
+                           const std::string& timeout_message,
+                           const std::function<bool(const std::vector<ip_address>&)>& check)
+{
+    if (!cache.wait_for(iface_idx, check, deadline::after(timeout)))
+    {
+        THROW_TIMEOUT(timeout_message);
+    }
+}
 
-        struct ifinfomsg* iface_info = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(msg_ptr));
-        int len = msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*iface_info));
+std::vector<std::string> netiface::get_iface_names(netlink* session)
+{
+    std::vector<std::string> iface_names;
 
-        for (struct rtattr* attribute = IFLA_RTA(iface_info); RTA_OK(attribute, len); attribute = RTA_NEXT(attribute, len))
+    netlink& nl = session ? *session : netlink::thread_session();
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    nl.send_dump_sync(message, [&]{ iface_names.clear(); }, [&](struct nlmsghdr* msg_ptr) {
+        link_view link;
+        if (parse_link(msg_ptr, link) && !link.name.empty())
         {
-            switch (attribute->rta_type)
-            {
-            case IFLA_IFNAME:
-                iface_names.push_back(reinterpret_cast<char*>(RTA_DATA(attribute)));
-                break;
-            default:
-                break;
-            }
+            iface_names.emplace_back(link.name);
         }
     });
     return iface_names;
 }
 
-netiface::netiface(const std::string& name)
+netiface::netiface(const std::string& name, netlink* session)
+    : index_(-1),
+      session_(session),
+      link_info_max_age_(0),
+      link_cache_(nullptr),
+      address_cache_(nullptr),
+      confirm_timeout_(500)
 {
-    std::vector<std::string> all_ifaces = get_iface_names();
-    if (!contains(all_ifaces, name))
+    name_ = name;
+    index_ = lookup_index();
+    if (index_ < 0)
     {
-        LOG_DEBUG("all_ifaces=[{}]", join(all_ifaces));
         THROW_NETEX("Specified interface does not exist name={}", name);
     }
-    name_ = name;
 }
 
 std::string netiface::get_name()
@@ -77,142 +455,233 @@ std::string netiface::get_name()
     return name_;
 }
 
+void netiface::set_timeout(std::chrono::milliseconds timeout)
+{
+    timeout_ = timeout;
+}
+
+netlink& netiface::session()
+{
+    return session_ ? *session_ : netlink::thread_session();
+}
+
+netlink::deadline_scope netiface::operation_scope(netlink& nl)
+{
+    // Every request an operation makes comes out of one budget, so a slow lookup leaves less time for the rest
+    return netlink::deadline_scope(nl, timeout_ ? deadline::after(*timeout_) : nl.get_deadline());
+}
+
 iface_idx_t netiface::get_index()
+{
+    return index_;
+}
+
+iface_idx_t netiface::lookup_index()
 {
     int iface_index = -1;
 
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK);
+    init_link_name_request(message, name_);
 
-    nl.send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
-        if (msg_ptr->nlmsg_type != RTM_NEWLINK)
+    int result = nl.send_messages({ message }, [&](size_t, struct nlmsghdr* msg_ptr) {
+        iface_idx_t idx = match_link_name(msg_ptr, name_);
+        if (idx > 0)
         {
-            LOG_WARN("Recieved unknown message type {}", msg_ptr->nlmsg_type);
-            return;
+            iface_index = idx;
         }
+    })[0];
+    if (result != 0 && result != ENODEV)
+    {
+        netlink::throw_error(result);
+    }
 
-        struct ifinfomsg* iface_info = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(msg_ptr));
-        int len = msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*iface_info));
-
-        for (struct rtattr* attribute = IFLA_RTA(iface_info); RTA_OK(attribute, len); attribute = RTA_NEXT(attribute, len))
-        {
-            switch (attribute->rta_type)
-            {
-            case IFLA_IFNAME:
-                if (name_ == std::string(reinterpret_cast<char*>(RTA_DATA(attribute))))
-                {
-                    iface_index = iface_info->ifi_index;
-                }
-                return;
-            default:
-                break;
-            }
+    return iface_index;
+}
 
-            if (iface_index > 0)
-            {
-                break;
-            }
-        }
-    });
+bool netiface::refresh_index()
+{
+    iface_idx_t iface_idx = lookup_index();
+    if (iface_idx < 0)
+    {
+        THROW_NETEX("Interface no longer exists name={}", name_);
+    }
+    if (iface_idx == index_)
+    {
+        return false;
+    }
+    LOG_DEBUG("Interface name={} was created again, index={} is now index={}", name_, index_, iface_idx);
+    index_ = iface_idx;
+    return true;
+}
 
-    return iface_index;
+/**
+ * @brief Run a request against the index of the interface, and run it again if the index turns out to be stale
+ *
+ * @param operation     makes the request with the index it is given, and returns its errno value
+ * @return the errno value of the last request
+ */
+template <typename Operation>
+int netiface::with_index(Operation operation)
+{
+    int result = operation(index_);
+    if (result == ENODEV && refresh_index())
+    {
+        result = operation(index_);
+    }
+    return result;
 }
 
-mtu_t netiface::get_mtu()
+link_info netiface::get_link_info()
 {
-    mtu_t iface_mtu;
-    iface_idx_t iface_idx = get_index();
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK);
+    init_link_name_request(message, name_);
 
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    std::optional<link_info> info;
     nl.send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
-        if (msg_ptr->nlmsg_type != RTM_NEWLINK)
+        link_view link;
+        if (parse_link(msg_ptr, link) && link.name == name_)
         {
-            LOG_WARN("Recieved unknown message type {}", msg_ptr->nlmsg_type);
-            return;
+            info = make_link_info(link);
         }
+    });
+    if (!info)
+    {
+        THROW_NETEX("Interface no longer exists name={}", name_);
+    }
+
+    // The link is asked for by name, so the reply also says if it was created again under a new index
+    if (info->index != index_)
+    {
+        LOG_DEBUG("Interface name={} was created again, index={} is now index={}", name_, index_, info->index);
+        index_ = info->index;
+    }
+    link_info_ = info;
+    link_info_time_ = std::chrono::steady_clock::now();
+    return *info;
+}
 
-        struct ifinfomsg* iface_info = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(msg_ptr));
-        if (iface_info->ifi_index != iface_idx)
+void netiface::set_confirm_timeout(std::chrono::milliseconds timeout)
+{
+    confirm_timeout_ = timeout;
+}
+
+netlink* netiface::watch_changes()
+{
+    // An emulated or replayed session makes its changes where the kernel cannot see them
+    if (session().is_using_transport())
+    {
+        return nullptr;
+    }
+    try
+    {
+        if (!monitor_)
         {
-            return;
+            auto monitor = std::make_shared<netlink>();
+            monitor->set_nonblocking();
+            monitor->add_membership(RTNLGRP_LINK);
+            monitor->add_membership(RTNLGRP_IPV4_IFADDR);
+            monitor->add_membership(RTNLGRP_IPV6_IFADDR);
+            monitor_ = std::move(monitor);
         }
 
-        int len = msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*iface_info));
-        for (struct rtattr* attribute = IFLA_RTA(iface_info); RTA_OK(attribute, len); attribute = RTA_NEXT(attribute, len))
+        // Whatever happened since the last change was made is of no interest
+        bool draining = true;
+        while (draining)
         {
-            switch (attribute->rta_type)
+            try
             {
-            case IFLA_MTU:
-                iface_mtu = *reinterpret_cast<mtu_t*>(RTA_DATA(attribute));
-                return;
-            default:
-                break;
+                draining = monitor_->receive_available([](struct nlmsghdr*) {});
             }
+            catch (const inconsistent_dump&)
+            { }
         }
-    });
-    return iface_mtu;
+    }
+    catch (const fnc_exception& ex)
+    {
+        LOG_DEBUG("Failed to listen for changes to iface={}, looking for them instead: {}", name_, ex.message);
+        monitor_.reset();
+    }
+    return monitor_.get();
 }
 
-void netiface::set_mtu(mtu_t mtu)
+void netiface::set_link_info_max_age(std::chrono::milliseconds max_age)
 {
-    LOG_DEBUG("Setting MTU={} iface={}", mtu, name_);
-    iface_idx_t iface_idx = get_index();
-
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK);
-    message.req.ifinfo.ifi_index = iface_idx;
-    message.req.ifinfo.ifi_change = 0xFFFFFFFF;
-
-    struct rtattr *attr = (struct rtattr *)(((char *) &message.req) + NLMSG_ALIGN(message.req.hdr.nlmsg_len));
-    attr->rta_type = IFLA_MTU;
-    attr->rta_len = RTA_LENGTH(sizeof(mtu));
-    message.req.hdr.nlmsg_len = NLMSG_ALIGN(message.req.hdr.nlmsg_len) + RTA_LENGTH(sizeof(mtu));
-    memcpy(RTA_DATA(attr), &mtu, sizeof(mtu));
-
-    // Send the message and wait for an ACK
-    nl.send_message_sync(message);
+    link_info_max_age_ = max_age;
+}
 
-    // Verify MTU was updated
-    WaitFor(std::chrono::milliseconds(500), fmt::format("Failed to set MTU={} on iface={}", mtu, name_), [&]{
-        return get_mtu() == mtu;
-    });
+void netiface::use_link_cache(link_cache* cache)
+{
+    link_cache_ = cache;
 }
 
-mac_address netiface::get_mac_address()
+void netiface::use_address_cache(address_cache* cache)
 {
-    mac_address mac_addr;
-    iface_idx_t iface_idx = get_index();
+    address_cache_ = cache;
+}
 
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
-    nl.send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
-        if (msg_ptr->nlmsg_type != RTM_NEWLINK)
+const link_info& netiface::cached_link_info()
+{
+    if (link_cache_)
+    {
+        std::optional<link_info> info = link_cache_->get(name_);
+        if (info)
         {
-            LOG_WARN("Recieved unknown message type {}", msg_ptr->nlmsg_type);
-            return;
+            index_ = info->index;
+            link_info_ = std::move(info);
+            return *link_info_;
         }
+    }
+    if (!link_info_ || std::chrono::steady_clock::now() - link_info_time_ >= link_info_max_age_)
+    {
+        get_link_info();
+    }
+    return *link_info_;
+}
 
-        struct ifinfomsg* iface_info = reinterpret_cast<ifinfomsg*>(NLMSG_DATA(msg_ptr));
-        if (iface_info->ifi_index != iface_idx)
-        {
-            return;
-        }
+mtu_t netiface::get_mtu()
+{
+    return cached_link_info().mtu;
+}
 
-        int len = msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*iface_info));
-        for (struct rtattr* attribute = IFLA_RTA(iface_info); RTA_OK(attribute, len); attribute = RTA_NEXT(attribute, len))
-        {
-            switch (attribute->rta_type)
-            {
-                case IFLA_ADDRESS:
-                    mac_addr = mac_address(reinterpret_cast<uint8_t*>(RTA_DATA(attribute)));
-                    return;
-                default:
-                    break;
-            }
-        }
+void netiface::set_mtu(mtu_t mtu)
+{
+    LOG_DEBUG("Setting MTU={} iface={}", mtu, name_);
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    link_info_.reset();
+    netlink* monitor = watch_changes();
+
+    // Send the message and wait for an ACK, and the new link if the kernel echoes it
+    bool echoed = false;
+    int result = with_index([&](iface_idx_t iface_idx) {
+        nl_msg message = nl.init_message(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK | NLM_F_ECHO);
+        init_mtu_message(message, iface_idx, mtu);
+        return nl.send_messages({ message }, [&](size_t, struct nlmsghdr* msg_ptr) {
+            echoed = echoed || is_mtu_echo(msg_ptr, iface_idx, mtu);
+        })[0];
     });
-    return mac_addr;
+    if (result != 0)
+    {
+        netlink::throw_error(result);
+    }
+    if (echoed)
+    {
+        return;
+    }
+
+    // Verify MTU was updated
+    confirm_change(monitor, settle_time(nl, confirm_timeout_), fmt::format("Failed to set MTU={} on iface={}", mtu, name_),
+        [&](struct nlmsghdr* msg_ptr) { return is_mtu_echo(msg_ptr, index_, mtu); },
+        [&]{ return get_link_info().mtu == mtu; });
+}
+
+mac_address netiface::get_mac_address()
+{
+    return cached_link_info().mac;
 }
 
 std::vector<ip_address> netiface::get_ip_addresses(const ip_family_type& ip_family)
@@ -222,81 +691,40 @@ std::vector<ip_address> netiface::get_ip_addresses(const ip_family_type& ip_fami
 
 std::vector<ip_address> netiface::get_ip_addresses_impl(const ip_family_type& ip_family, bool include_prefix)
 {
-    bool get_v4 = (ip_family & ip_family_type::v4) == ip_family_type::v4;
-    bool get_v6 = (ip_family & ip_family_type::v6) == ip_family_type::v6;
-
-    iface_idx_t iface_idx = get_index();
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_GETADDR, NLM_F_REQUEST | NLM_F_MATCH);
-    message.req.ifaddr.ifa_index = iface_idx;
-
-    std::vector<ip_address> addresses;
-    nl.send_message_sync(message, [&](struct nlmsghdr* msg_ptr) {
-        if (msg_ptr->nlmsg_type != RTM_NEWADDR)
+    if (address_cache_)
+    {
+        std::vector<ip_address> addresses = address_cache_->get(index_, ip_family);
+        if (!include_prefix)
         {
-            LOG_INFO("Recieved unknown message type {}", msg_ptr->nlmsg_type);
-            return;
+            std::transform(addresses.begin(), addresses.end(), addresses.begin(), [](const ip_address& address) { return address.without_prefix(); });
         }
+        return addresses;
+    }
 
-        struct ifaddrmsg* addr_info = reinterpret_cast<struct ifaddrmsg*>(NLMSG_DATA(msg_ptr));
-        if (addr_info->ifa_index != (uint32_t)iface_idx)
-        {
-            return;
-        }
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    std::vector<ip_address> addresses;
+    auto dump = [&](iface_idx_t iface_idx) {
+        nl_msg message = nl.init_message(RTM_GETADDR, NLM_F_REQUEST | NLM_F_DUMP);
+        init_address_dump(message, iface_idx, ip_family);
+        nl.send_dump_sync(message, [&]{ addresses.clear(); }, [&](struct nlmsghdr* msg_ptr) {
+            add_address(msg_ptr, iface_idx, ip_family, include_prefix, addresses);
+        });
+    };
 
-        int len = msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*addr_info));
-        char ipaddr_str[INET6_ADDRSTRLEN];
-        for (struct rtattr* attribute = IFA_RTA(addr_info); RTA_OK(attribute, len); attribute = RTA_NEXT(attribute, len))
+    // A strictly checked dump fails with ENODEV if the index is stale. Without strict checking it comes back empty
+    try
+    {
+        dump(index_);
+    }
+    catch (const network_exception&)
+    {
+        if (!refresh_index())
         {
-            switch (attribute->rta_type)
-            {
-                case IFA_ADDRESS:
-                    if (addr_info->ifa_family == AF_INET && !get_v4)
-                    {
-                        return;
-                    }
-                    if (addr_info->ifa_family == AF_INET6 && !get_v6)
-                    {
-                        return;
-                    }
-                    inet_ntop(addr_info->ifa_family, RTA_DATA(attribute), ipaddr_str, sizeof(ipaddr_str));
-                    if (include_prefix)
-                    {
-                        addresses.emplace_back(ipaddr_str, (int)addr_info->ifa_prefixlen);
-                    }
-                    else
-                    {
-                        addresses.emplace_back(ipaddr_str);
-                    }
-                    break;
-                /*
-                case IFA_LABEL:
-                    LOG_DEBUG("    label {}", (char*)RTA_DATA(attribute));
-                    break;
-                case IFA_LOCAL:
-                    inet_ntop(addr_info->ifa_family, RTA_DATA(attribute), ipaddr_str, sizeof(ipaddr_str));
-                    LOG_DEBUG("    local {}", ipaddr_str);
-                    break;
-                case IFA_BROADCAST:
-                    inet_ntop(addr_info->ifa_family, RTA_DATA(attribute), ipaddr_str, sizeof(ipaddr_str));
-                    LOG_DEBUG("    broadcast {}", ipaddr_str);
-                    break;
-                case IFA_ANYCAST:
-                    inet_ntop(addr_info->ifa_family, RTA_DATA(attribute), ipaddr_str, sizeof(ipaddr_str));
-                    LOG_DEBUG("    anycast {}", ipaddr_str);
-                    break;
-                case IFA_MULTICAST:
-                    inet_ntop(addr_info->ifa_family, RTA_DATA(attribute), ipaddr_str, sizeof(ipaddr_str));
-                    LOG_DEBUG("    multicast {}", ipaddr_str);
-                    break;
-                case IFA_FLAGS:
-                    LOG_DEBUG("    flags {}", *(uint32_t*)RTA_DATA(attribute));
-                */
-                default:
-                    break;
-            }
+            throw;
         }
-    });
+        dump(index_);
+    }
     //LOG_DEBUG("Found ip addresses [{}]", join(addresses));
     return addresses;
 }
@@ -309,100 +737,334 @@ void netiface::set_ip_address(ip_address address)
     }
 
     LOG_DEBUG("Adding address={} to iface={}", address, name_);
-    if (contains(get_ip_addresses(), address))
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    netlink* monitor = address_cache_ ? nullptr : watch_changes();
+
+    // Send the message and wait for an ACK, and the new address if the kernel echoes it
+    bool echoed = false;
+    int result = with_index([&](iface_idx_t iface_idx) {
+        nl_msg message = nl.init_message(RTM_NEWADDR, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK | NLM_F_ECHO);
+        init_address_message(message, iface_idx, address, address.get_prefix());
+        return nl.send_messages({ message }, [&](size_t, struct nlmsghdr* msg_ptr) {
+            echoed = echoed || is_address_echo(msg_ptr, RTM_NEWADDR, iface_idx, address);
+        })[0];
+    });
+    if (result == EEXIST)
+    {
+        // IPv6 addresses clash whatever their prefix, so only the exact address counts as already present
+        if (contains(get_ip_addresses(), address))
+        {
+            LOG_DEBUG("Address={} already present on iface={}", address, name_);
+            return;
+        }
+    }
+    if (result != 0)
+    {
+        netlink::throw_error(result);
+    }
+    if (echoed && !address_cache_)
     {
-        LOG_DEBUG("Address={} already present on iface={}", address, name_);
         return;
     }
 
-    iface_idx_t iface_idx = get_index();
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_NEWADDR, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK);
-    message.req.ifaddr.ifa_index = iface_idx;
-    message.req.ifaddr.ifa_prefixlen = address.get_prefix();
-    message.req.ifaddr.ifa_scope = address.get_scope();
-    message.req.ifaddr.ifa_family = address.is_v4() ? AF_INET : AF_INET6;
+    // Verify IP is on the interface. With an address cache this waits for the notification to reach it, so the
+    // address can be read back as soon as this returns
+    std::string timeout_message = fmt::format("Failed to add IP address={} to iface={}", address, name_);
+    if (address_cache_)
+    {
+        confirm_cached(*address_cache_, index_, settle_time(nl, confirm_timeout_), timeout_message, [&](const std::vector<ip_address>& addresses) {
+            return contains(addresses, address);
+        });
+        return;
+    }
+    confirm_change(monitor, settle_time(nl, confirm_timeout_), timeout_message,
+        [&](struct nlmsghdr* msg_ptr) { return is_address_echo(msg_ptr, RTM_NEWADDR, index_, address); },
+        [&]{ return contains(get_ip_addresses(), address); });
+}
 
-    struct rtattr *attr = (struct rtattr *)(((char *) &message.req) + NLMSG_ALIGN(message.req.hdr.nlmsg_len));
-    attr->rta_type = IFA_LOCAL;
+void netiface::set_ip_addresses(const std::vector<ip_address>& addresses)
+{
+    for (const auto& address : addresses)
+    {
+        if (address.get_prefix() < 0)
+        {
+            THROW_NETEX("Invalid or unspecified prefix length for address={}", address);
+        }
+    }
 
-    if (address.is_v4())
+    LOG_DEBUG("Adding {} addresses to iface={}", addresses.size(), name_);
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    auto current_ips = get_ip_addresses();
+    std::vector<ip_address> new_ips;
+    for (const auto& address : addresses)
     {
-        struct sockaddr_in addr = address.to_sockaddr_in();
-        attr->rta_len = RTA_LENGTH(sizeof(addr.sin_addr));
-        memcpy(RTA_DATA(attr), &addr.sin_addr, sizeof(addr.sin_addr));
-        message.req.hdr.nlmsg_len = NLMSG_ALIGN(message.req.hdr.nlmsg_len) + RTA_LENGTH(sizeof(addr.sin_addr));
+        if (!contains(current_ips, address) && !contains(new_ips, address))
+        {
+            new_ips.push_back(address);
+        }
     }
-    else if (address.is_v6())
+    if (new_ips.empty())
     {
-        struct sockaddr_in6 addr = address.to_sockaddr_in6();
-        attr->rta_len = RTA_LENGTH(sizeof(addr.sin6_addr));
-        memcpy(RTA_DATA(attr), &addr.sin6_addr, sizeof(addr.sin6_addr));
-        message.req.hdr.nlmsg_len = NLMSG_ALIGN(message.req.hdr.nlmsg_len) + RTA_LENGTH(sizeof(addr.sin6_addr));
+        LOG_DEBUG("All addresses already present on iface={}", name_);
+        return;
     }
+    netlink* monitor = address_cache_ ? nullptr : watch_changes();
 
-    // Send the message and wait for an ACK
-    nl.send_message_sync(message);
-
-    // Verify IP is on the interface
-    WaitFor(std::chrono::milliseconds(500), fmt::format("Failed to add IP address={} to iface={}", address, name_), [&]{
-        return contains(get_ip_addresses(), address);
+    // Send all of the requests at once and collect the ones that failed, and the ones the kernel echoed. If the
+    // index is stale every request fails, so the first result is enough to tell
+    std::vector<bool> echoed;
+    std::vector<int> results;
+    with_index([&](iface_idx_t iface_idx) {
+        netlink_builder batch(new_ips.size() * NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct ifaddrmsg)) + RTA_LENGTH(sizeof(struct in6_addr))));
+        for (const auto& address : new_ips)
+        {
+            nl.init_message(batch, RTM_NEWADDR, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK | NLM_F_ECHO);
+            init_address_message(batch, iface_idx, address, address.get_prefix());
+        }
+        echoed.assign(new_ips.size(), false);
+        results = nl.send_messages(batch, [&](size_t idx, struct nlmsghdr* msg_ptr) {
+            echoed[idx] = echoed[idx] || is_address_echo(msg_ptr, RTM_NEWADDR, iface_idx, new_ips[idx]);
+        });
+        return results.front();
     });
+    std::vector<std::string> failures;
+    std::vector<ip_address> unconfirmed;
+    for (size_t idx = 0; idx < results.size(); ++idx)
+    {
+        if (results[idx] != 0 && results[idx] != EEXIST)
+        {
+            failures.push_back(fmt::format("{} ({})", new_ips[idx], strerror(results[idx])));
+        }
+        else if (!echoed[idx] || address_cache_)
+        {
+            unconfirmed.push_back(new_ips[idx]);
+        }
+    }
+    if (!failures.empty())
+    {
+        THROW_NETEX("Failed to add IP addresses to iface={}: {}", name_, join(failures));
+    }
+    if (unconfirmed.empty())
+    {
+        return;
+    }
+
+    // Verify the IPs that were not echoed are on the interface
+    std::string timeout_message = fmt::format("Failed to add IP addresses to iface={}", name_);
+    auto all_present = [&](const std::vector<ip_address>& ips) {
+        return std::all_of(unconfirmed.begin(), unconfirmed.end(), [&](const ip_address& address) { return contains(ips, address); });
+    };
+    if (address_cache_)
+    {
+        confirm_cached(*address_cache_, index_, settle_time(nl, confirm_timeout_), timeout_message, all_present);
+        return;
+    }
+    confirm_change(monitor, settle_time(nl, confirm_timeout_), timeout_message,
+        [&](struct nlmsghdr* msg_ptr) {
+            unconfirmed.erase(std::remove_if(unconfirmed.begin(), unconfirmed.end(), [&](const ip_address& address) {
+                return is_address_echo(msg_ptr, RTM_NEWADDR, index_, address);
+            }), unconfirmed.end());
+            return unconfirmed.empty();
+        },
+        [&]{ return all_present(get_ip_addresses()); });
 }
 
 void netiface::del_ip_address(ip_address address)
 {
     LOG_DEBUG("Deleting address={} iface={}", address, name_);
-    auto current_ips = get_ip_addresses();
-    bool already_deleted;
-    if (address.is_v4())
+    netlink& nl = session();
+    auto scope = operation_scope(nl);
+    netlink* monitor = address_cache_ ? nullptr : watch_changes();
+
+    // Send the message and wait for an ACK, and the deleted address if the kernel echoes it
+    bool echoed = false;
+    int result = with_index([&](iface_idx_t iface_idx) {
+        nl_msg message = nl.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK | NLM_F_ECHO);
+        init_address_message(message, iface_idx, address, address.is_v4() ? 32 : address.get_prefix());
+        return nl.send_messages({ message }, [&](size_t, struct nlmsghdr* msg_ptr) {
+            echoed = echoed || is_address_echo(msg_ptr, RTM_DELADDR, iface_idx, address);
+        })[0];
+    });
+    if (result == EADDRNOTAVAIL)
     {
-        // Compare without prefix, because prefix does not matter (we delete with prefix 32)
-        already_deleted = !contains(get_ip_addresses(), address, [&address](const auto& item) { return item.without_prefix() == address.without_prefix(); });
+        LOG_DEBUG("Address={} already deleted from iface={}", address, name_);
+        return;
     }
-    else
+    if (result != 0)
     {
-        already_deleted = !contains(get_ip_addresses(), address);
+        netlink::throw_error(result);
     }
-    if (already_deleted)
+    if (echoed && !address_cache_)
     {
-        LOG_DEBUG("Address={} already deleted from iface={}", address, name_);
         return;
     }
 
-    iface_idx_t iface_idx = get_index();
-    netlink nl;
-    nl_msg message = nl.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK);
-    message.req.ifaddr.ifa_index = iface_idx;
-    message.req.ifaddr.ifa_prefixlen = address.is_v4() ? 32 :  address.get_prefix();
-    message.req.ifaddr.ifa_scope = address.get_scope();
-    message.req.ifaddr.ifa_family = address.is_v4() ? AF_INET : AF_INET6;
+    // Verify IP is gone from the interface, or from the address cache
+    std::string timeout_message = fmt::format("Failed to delete IP address={} from iface={}", address, name_);
+    if (address_cache_)
+    {
+        confirm_cached(*address_cache_, index_, settle_time(nl, confirm_timeout_), timeout_message, [&](const std::vector<ip_address>& addresses) {
+            return !contains(addresses, address.without_prefix(), [&](const ip_address& item) { return item.without_prefix() == address.without_prefix(); });
+        });
+        return;
+    }
+    confirm_change(monitor, settle_time(nl, confirm_timeout_), timeout_message,
+        [&](struct nlmsghdr* msg_ptr) { return is_address_echo(msg_ptr, RTM_DELADDR, index_, address); },
+        [&]{ return !contains(get_ip_addresses_impl(ip_family_type::all, false), address.without_prefix()); });
+}
 
-    struct rtattr *attr = (struct rtattr *)(((char *) &message.req) + NLMSG_ALIGN(message.req.hdr.nlmsg_len));
-    attr->rta_type = IFA_LOCAL;
+#ifdef FNC_HAS_COROUTINES
 
-    if (address.is_v4())
+/**
+ * @brief Coroutine version of WaitFor, that suspends instead of sleeping between tries
+ */
+template <typename Condition>
+static task<void> co_wait_for(event_loop& loop, std::chrono::milliseconds timeout, std::string timeout_message, Condition condition)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    while (!(co_await condition()))
     {
-        struct sockaddr_in addr = address.to_sockaddr_in();
-        attr->rta_len = RTA_LENGTH(sizeof(addr.sin_addr));
-        memcpy(RTA_DATA(attr), &addr.sin_addr, sizeof(addr.sin_addr));
-        message.req.hdr.nlmsg_len = NLMSG_ALIGN(message.req.hdr.nlmsg_len) + RTA_LENGTH(sizeof(addr.sin_addr));
+        if (std::chrono::steady_clock::now() - start_time > timeout)
+        {
+            THROW_TIMEOUT(timeout_message);
+        }
+        co_await loop_sleep(loop, std::chrono::milliseconds(50));
     }
-    else if (address.is_v6())
+}
+
+task<iface_idx_t> netiface::co_get_index(netlink_async& nl)
+{
+    int iface_index = -1;
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK);
+    init_link_name_request(message, name_);
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        iface_idx_t idx = match_link_name(msg_ptr, name_);
+        if (idx > 0)
+        {
+            iface_index = idx;
+        }
+    });
+    co_return iface_index;
+}
+
+task<link_info> netiface::co_get_link_info(netlink_async& nl)
+{
+    link_info info;
+    nl_msg message = nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK);
+    init_link_name_request(message, name_);
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        link_view link;
+        if (parse_link(msg_ptr, link) && link.name == name_)
+        {
+            info = make_link_info(link);
+        }
+    });
+    co_return info;
+}
+
+task<mtu_t> netiface::co_get_mtu(netlink_async& nl)
+{
+    co_return (co_await co_get_link_info(nl)).mtu;
+}
+
+task<void> netiface::co_set_mtu(netlink_async& nl, mtu_t mtu)
+{
+    LOG_DEBUG("Setting MTU={} iface={}", mtu, name_);
+    iface_idx_t iface_idx = co_await co_get_index(nl);
+
+    nl_msg message = nl.init_message(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK | NLM_F_ECHO);
+    init_mtu_message(message, iface_idx, mtu);
+    bool echoed = false;
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        echoed = echoed || is_mtu_echo(msg_ptr, iface_idx, mtu);
+    });
+    if (echoed)
     {
-        struct sockaddr_in6 addr = address.to_sockaddr_in6();
-        attr->rta_len = RTA_LENGTH(sizeof(addr.sin6_addr));
-        memcpy(RTA_DATA(attr), &addr.sin6_addr, sizeof(addr.sin6_addr));
-        message.req.hdr.nlmsg_len = NLMSG_ALIGN(message.req.hdr.nlmsg_len) + RTA_LENGTH(sizeof(addr.sin6_addr));
+        co_return;
     }
 
-    // Send the message and wait for an ACK
-    nl.send_message_sync(message);
+    co_await co_wait_for(nl.get_loop(), std::chrono::milliseconds(500), fmt::format("Failed to set MTU={} on iface={}", mtu, name_), [&]() -> task<bool> {
+        co_return (co_await co_get_mtu(nl)) == mtu;
+    });
+}
+
+task<mac_address> netiface::co_get_mac_address(netlink_async& nl)
+{
+    co_return (co_await co_get_link_info(nl)).mac;
+}
+
+task<std::vector<ip_address>> netiface::co_get_ip_addresses(netlink_async& nl, ip_family_type ip_family)
+{
+    iface_idx_t iface_idx = co_await co_get_index(nl);
+    nl_msg message = nl.init_message(RTM_GETADDR, NLM_F_REQUEST | NLM_F_DUMP);
+    init_address_dump(message, iface_idx, ip_family);
 
-    // Verify IP is gone from the interface
-    WaitFor(std::chrono::milliseconds(500), fmt::format("Failed to delete IP address={} from iface={}", address, name_), [&]{
-        return !contains(get_ip_addresses_impl(ip_family_type::all, false), address.without_prefix());
+    std::vector<ip_address> addresses;
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        add_address(msg_ptr, iface_idx, ip_family, true, addresses);
     });
+    co_return addresses;
 }
 
+task<void> netiface::co_set_ip_address(netlink_async& nl, ip_address address)
+{
+    if (address.get_prefix() < 0)
+    {
+        THROW_NETEX("Invalid or unspecified prefix length for address={}", address);
+    }
+
+    LOG_DEBUG("Adding address={} to iface={}", address, name_);
+    if (contains(co_await co_get_ip_addresses(nl), address))
+    {
+        LOG_DEBUG("Address={} already present on iface={}", address, name_);
+        co_return;
+    }
+
+    iface_idx_t iface_idx = co_await co_get_index(nl);
+    nl_msg message = nl.init_message(RTM_NEWADDR, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK | NLM_F_ECHO);
+    init_address_message(message, iface_idx, address, address.get_prefix());
+    bool echoed = false;
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        echoed = echoed || is_address_echo(msg_ptr, RTM_NEWADDR, iface_idx, address);
+    });
+    if (echoed)
+    {
+        co_return;
+    }
+
+    co_await co_wait_for(nl.get_loop(), std::chrono::milliseconds(500), fmt::format("Failed to add IP address={} to iface={}", address, name_), [&]() -> task<bool> {
+        co_return contains(co_await co_get_ip_addresses(nl), address);
+    });
+}
+
+task<void> netiface::co_del_ip_address(netlink_async& nl, ip_address address)
+{
+    LOG_DEBUG("Deleting address={} iface={}", address, name_);
+    if (!contains_for_delete(co_await co_get_ip_addresses(nl), address))
+    {
+        LOG_DEBUG("Address={} already deleted from iface={}", address, name_);
+        co_return;
+    }
+
+    iface_idx_t iface_idx = co_await co_get_index(nl);
+    nl_msg message = nl.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK | NLM_F_ECHO);
+    init_address_message(message, iface_idx, address, address.is_v4() ? 32 : address.get_prefix());
+    bool echoed = false;
+    co_await async_request(nl, message, [&](struct nlmsghdr* msg_ptr) {
+        echoed = echoed || is_address_echo(msg_ptr, RTM_DELADDR, iface_idx, address);
+    });
+    if (echoed)
+    {
+        co_return;
+    }
+
+    co_await co_wait_for(nl.get_loop(), std::chrono::milliseconds(500), fmt::format("Failed to delete IP address={} from iface={}", address, name_), [&]() -> task<bool> {
+        co_return !contains_for_delete(co_await co_get_ip_addresses(nl), address);
+    });
+}
+
+#endif // FNC_HAS_COROUTINES
+
 } // end namespace fnc
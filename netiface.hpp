@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <memory>
 #include <net/if.h>
+#include <optional>
 #include <string>
 #include <vector>
 #include "ip_address.hpp"
 #include "mac_address.hpp"
 #include "netlink.hpp"
+#include "netlink_coro.hpp"
 #include "util/mac_helper.hpp"
 #include "util/bitmask_operators.hpp"
 
@@ -23,6 +27,52 @@ enum class ip_family_type
 ENABLE_BITMASK_OPERATORS(ip_family_type);
 std::ostream& operator << (std::ostream& os, const ip_family_type& obj);
 
+/**
+ * @brief RFC 2863 operational state of a link, the IF_OPER_* values from linux/if.h, which clashes with net/if.h
+ */
+enum class oper_state : uint8_t
+{
+    unknown             = 0,
+    not_present         = 1,
+    down                = 2,
+    lower_layer_down    = 3,
+    testing             = 4,
+    dormant             = 5,
+    up                  = 6
+};
+
+/**
+ * @brief The state of a link, all from a single RTM_GETLINK reply
+ */
+struct link_info
+{
+    iface_idx_t index = -1;
+    std::string name;
+    mtu_t mtu = 0;
+    mac_address mac;
+    unsigned flags = 0;                             ///< IFF_UP, IFF_RUNNING and the rest of the ifi_flags
+    oper_state operstate = oper_state::unknown;
+    uint32_t txqueuelen = 0;
+};
+
+/**
+ * @brief Parse an RTM_NEWLINK message, either a reply or a notification
+ *
+ * @return false if it is some other kind of message
+ */
+bool parse_link_info(struct nlmsghdr* msg_ptr, link_info& info);
+
+/**
+ * @brief Parse an RTM_NEWADDR or RTM_DELADDR message, either a reply or a notification
+ *
+ * @param index     set to the index of the interface the address is on
+ * @return the address with its prefix, or nothing if it is some other kind of message
+ */
+std::optional<ip_address> parse_address_info(struct nlmsghdr* msg_ptr, iface_idx_t& index);
+
+class address_cache;
+class link_cache;
+
 class netiface
 {
 public:
@@ -30,15 +80,51 @@ public:
     /**
      * @brief Get a list of all network interfaces on this system
      *
+     * The dump has to finish by the deadline of the session, see netlink::deadline_scope
+     *
+     * @param session   netlink session to use, or nullptr to use the session of the calling thread
      * @return list of names
      */
-    static std::vector<std::string> get_iface_names();
+    static std::vector<std::string> get_iface_names(netlink* session = nullptr);
 
     /**
      * Constructor
-     * @param name  the name of the interface
+     *
+     * All operations on the interface share a single netlink session. By default this is the session of
+     * the calling thread, see netlink::thread_session()
+     *
+     * The index of the interface is looked up once here and used by every operation after that. The kernel never
+     * reuses an index while it is up, so if the interface is deleted and created again, a request with the old
+     * index fails with ENODEV, and the index is looked up again by name and the request repeated. Throws a
+     * network_exception if there is no interface with the name
+     *
+     * @param name      the name of the interface
+     * @param session   netlink session to use, or nullptr to use the session of the calling thread
+     */
+    netiface(const std::string& name, netlink* session = nullptr);
+
+    /**
+     * @brief Set how long each operation on this interface may take
+     *
+     * The limit covers the whole operation, including looking up the interface and waiting for a change to show
+     * up, and a timeout_exception is thrown if it runs out. An operation inside a netlink::deadline_scope on the
+     * session has to finish by whichever deadline comes first. By default the session timeout is used, see
+     * netlink::set_timeout
+     *
+     * @param timeout   the time allowed for each operation, negative for no limit
      */
-    netiface(const std::string& name);
+    void set_timeout(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Set how long a change may take to show up on this interface after the kernel has accepted it
+     *
+     * A change is confirmed by the notification the kernel sends for it, or the echo of the request, so it is
+     * normally confirmed as soon as the request returns. This only matters for a change the kernel finishes later.
+     * The operation timeout still applies, see set_timeout. By default it is 500ms
+     *
+     * @param timeout   how long to wait for a change
+     */
+    void set_confirm_timeout(std::chrono::milliseconds timeout);
 
     /**
      * @brief Get the name of this interface
@@ -50,13 +136,59 @@ public:
     /**
      * @brief Get the index of this interface
      *
+     * This does not make a request, it is the index found when the interface was opened, or the last time a
+     * request found that it had changed
+     *
      * @return index of the interface
      */
     iface_idx_t get_index();
 
+    /**
+     * @brief Get the state of this interface with a single request
+     *
+     * This always asks the kernel, whatever the freshness policy set with set_link_info_max_age, and the reply
+     * is kept for the getters that use it
+     *
+     * @return the state of the interface
+     */
+    link_info get_link_info();
+
+    /**
+     * @brief Set how old the state read by get_link_info may be before the getters ask the kernel again
+     *
+     * get_mtu and get_mac_address read from the last snapshot if it is younger than this, so code that reads
+     * several fields at a time costs one request instead of one per field. Changes made through this object
+     * always drop the snapshot. By default it is 0, and every getter asks the kernel
+     *
+     * @param max_age   how long a snapshot may be used for
+     */
+    void set_link_info_max_age(std::chrono::milliseconds max_age);
+
+    /**
+     * @brief Answer get_mtu and get_mac_address from a link_cache instead of asking the kernel
+     *
+     * The getters then cost a hash lookup, and follow the kernel as closely as the cache does. A link that is not
+     * in the cache is still asked for. get_link_info always asks the kernel
+     *
+     * @param cache     the cache to use, such as link_cache::instance(), or nullptr to stop using one
+     */
+    void use_link_cache(link_cache* cache);
+
+    /**
+     * @brief Answer get_ip_addresses, and the checks made around adding and deleting addresses, from an
+     * address_cache instead of dumping the addresses from the kernel
+     *
+     * The cache is looked up by the index of the interface, which is only found again after a request fails
+     * because the interface was created again
+     *
+     * @param cache     the cache to use, such as address_cache::instance(), or nullptr to stop using one
+     */
+    void use_address_cache(address_cache* cache);
+
     /**
      * @brief Get the MTU of this interface
      *
+     * @see set_link_info_max_age
      * @return MTU of the interface
      */
     mtu_t get_mtu();
@@ -71,6 +203,7 @@ public:
     /**
      * @brief Get the MAC address of this interface
      *
+     * @see set_link_info_max_age
      * @return the interface MAC address
      */
     mac_address get_mac_address();
@@ -96,6 +229,18 @@ public:
      */
     void set_ip_address(ip_address address);
 
+    /**
+     * @brief Add several IP addresses to this interface
+     *
+     * This behaves like calling set_ip_address for each address, but all of the requests are pipelined over
+     * the netlink session instead of waiting for each one in turn, which is much faster for large sets of
+     * addresses. Every address is attempted, and an exception listing all of the failures is thrown if any
+     * could not be added
+     *
+     * @param addresses The IP addresses to add
+     */
+    void set_ip_addresses(const std::vector<ip_address>& addresses);
+
     /**
      * @brief Remove an IP address from the interface
      *
@@ -106,10 +251,84 @@ public:
      */
     void del_ip_address(ip_address address);
 
+#ifdef FNC_HAS_COROUTINES
+    //
+    // Coroutine versions of the operations above. These run on a netlink_async session and suspend instead of
+    // blocking while they wait for the kernel, so one thread running the event loop can drive many interfaces.
+    //
+
+    /**
+     * @brief Get the index of this interface
+     * @see get_index
+     */
+    task<iface_idx_t> co_get_index(netlink_async& nl);
+
+    /**
+     * @brief Get the state of this interface
+     * @see get_link_info
+     */
+    task<link_info> co_get_link_info(netlink_async& nl);
+
+    /**
+     * @brief Get the MTU of this interface
+     * @see get_mtu
+     */
+    task<mtu_t> co_get_mtu(netlink_async& nl);
+
+    /**
+     * @brief Set the MTU of this interface
+     * @see set_mtu
+     */
+    task<void> co_set_mtu(netlink_async& nl, mtu_t mtu);
+
+    /**
+     * @brief Get the MAC address of this interface
+     * @see get_mac_address
+     */
+    task<mac_address> co_get_mac_address(netlink_async& nl);
+
+    /**
+     * @brief Get the ip addresses of this interface
+     * @see get_ip_addresses
+     */
+    task<std::vector<ip_address>> co_get_ip_addresses(netlink_async& nl, ip_family_type ip_family = ip_family_type::all);
+
+    /**
+     * @brief Add an IP address to this interface
+     * @see set_ip_address
+     */
+    task<void> co_set_ip_address(netlink_async& nl, ip_address address);
+
+    /**
+     * @brief Remove an IP address from the interface
+     * @see del_ip_address
+     */
+    task<void> co_del_ip_address(netlink_async& nl, ip_address address);
+#endif
+
 private:
     std::string name_;
+    iface_idx_t index_;
+    netlink* session_;
+    std::optional<std::chrono::milliseconds> timeout_;
+    std::chrono::milliseconds link_info_max_age_;
+    std::optional<link_info> link_info_;
+    std::chrono::steady_clock::time_point link_info_time_;
+    link_cache* link_cache_;
+    address_cache* address_cache_;
+    std::chrono::milliseconds confirm_timeout_;
+    std::shared_ptr<netlink> monitor_;
+
+    netlink& session();
+    netlink::deadline_scope operation_scope(netlink& nl);
 
     std::vector<ip_address> get_ip_addresses_impl(const ip_family_type& ip_family = ip_family_type::all, bool include_prefix = true);
+    const link_info& cached_link_info();
+    netlink* watch_changes();
+    iface_idx_t lookup_index();
+    bool refresh_index();
+    template <typename Operation>
+    int with_index(Operation operation);
 
 };
 
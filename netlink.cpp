@@ -5,95 +5,502 @@
 #include <netinet/in.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
-#include <sys/time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <unordered_map>
 
 #include "netlink.hpp"
 #include "exceptions.hpp"
 #include "logging.hpp"
 #include "util/mac_helper.hpp"
 
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12   // Added in 4.20
+#endif
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10          // Added in 4.3
+#endif
+
 namespace fnc
 {
 
-std::atomic_int netlink::session_(0);
+// user_data of the requests made through the io_uring transport
+static const uint64_t RING_RECV = 1;
+static const uint64_t RING_SEND = 2;
+static const uint64_t RING_CANCEL = 3;
+static const uint64_t RING_WAKE = 4;
+
+netlink::deadline_scope::deadline_scope(netlink& session, const deadline& limit)
+    : session_(session),
+      previous_(session.scope_deadline_)
+{
+    session_.scope_deadline_ = previous_ ? deadline::earliest(*previous_, limit) : limit;
+}
+
+netlink::deadline_scope::deadline_scope(netlink& session, std::chrono::milliseconds budget)
+    : deadline_scope(session, deadline::after(budget))
+{ }
+
+netlink::deadline_scope::~deadline_scope()
+{
+    session_.scope_deadline_ = previous_;
+}
+
+netlink::netlink(int protocol)
+    : protocol_(protocol),
+      pid_(0),
+      nl_sock_(-1),
+      cancel_fd_(-1),
+      timeout_(DEFAULT_TIMEOUT),
+      seq_(0),
+      sent_seq_(0),
+      broken_(false),
+      nonblocking_(false),
+      strict_check_(false),
+      bulk_acks_(false),
+      rx_buffer_len_(0),
+      ring_buffer_len_(RX_BUFFER_LEN),
+      ring_armed_(false),
+      ring_send_result_(0),
+      ring_send_done_(false),
+      ring_recv_error_(0),
+      ring_syscalls_(0),
+      ring_wake_armed_(false),
+      ring_cancelled_(false)
+{
+    memset(&ring_msg_, 0, sizeof(ring_msg_));
+
+    // Outlives the socket, so a cancel is not lost if the session reconnects
+    stats_.syscalls++;
+    cancel_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (cancel_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create netlink cancel event: {}", strerror(errno));
+    }
+    try
+    {
+        open();
+    }
+    catch (...)
+    {
+        ::close(cancel_fd_);
+        throw;
+    }
+}
 
-netlink::netlink()
-    : pid_(0),
-      nl_sock_(0),
-      seq_(0)
+netlink::~netlink()
 {
-    pid_ = syscall(SYS_gettid) + session_++;
+    close();
+    ring_.reset();
+    ::close(cancel_fd_);
+}
 
-    nl_sock_ = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+netlink& netlink::thread_session()
+{
+    thread_local netlink session;
+    return session;
+}
 
-    struct timeval timeout;
-    timeout.tv_sec = NL_SOCKET_TIMEOUT;
-    timeout.tv_usec = 0;
+netlink& netlink::thread_generic_session()
+{
+    thread_local netlink session(NETLINK_GENERIC);
+    return session;
+}
 
-    if (setsockopt(nl_sock_, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0)
+void netlink::open()
+{
+    if (transport_)
+    {
+        // The transport stands in for the socket
+        broken_ = false;
+        return;
+    }
+    stats_.syscalls++;
+    nl_sock_ = socket(AF_NETLINK, SOCK_RAW, protocol_);
+    if (nl_sock_ < 0)
     {
-        THROW_NETEX("Failed to set timeout on netlink socket");
+        THROW_NETEX("Failed to create netlink socket: {}", strerror(errno));
     }
+    stats_.sockets_opened++;
 
     struct sockaddr_nl local_sa;
     memset(&local_sa, 0, sizeof(local_sa));
     local_sa.nl_family = AF_NETLINK;
-    local_sa.nl_pid = pid_;
+    local_sa.nl_pid = 0;    // Let the kernel pick a port that is not in use
     local_sa.nl_groups = 0;
-    LOG_TRACE("Binding netlink socket with pid={}", pid_);
+    stats_.syscalls++;
     if (bind(nl_sock_, (struct sockaddr *) &local_sa, sizeof(local_sa)) != 0)
     {
-        THROW_NETEX("Failed to bind netlink socket: {}", strerror(errno));
+        int bind_errno = errno;
+        close();
+        THROW_NETEX("Failed to bind netlink socket: {}", strerror(bind_errno));
+    }
+
+    socklen_t local_sa_len = sizeof(local_sa);
+    stats_.syscalls++;
+    if (getsockname(nl_sock_, (struct sockaddr *) &local_sa, &local_sa_len) != 0)
+    {
+        int sockname_errno = errno;
+        close();
+        THROW_NETEX("Failed to get netlink socket address: {}", strerror(sockname_errno));
+    }
+    pid_ = local_sa.nl_pid;
+    LOG_TRACE("Bound netlink socket with pid={}", pid_);
+
+    // Ask the kernel to check dump requests strictly and filter them by the fields set in the header, so a dump
+    // for one interface does not copy out everything on the host. Kernels before 4.20 do not have the option,
+    // and send the full dump which callers filter themselves
+    if (protocol_ == NETLINK_ROUTE)
+    {
+        int enable = 1;
+        stats_.syscalls++;
+        strict_check_ = setsockopt(nl_sock_, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &enable, sizeof(enable)) == 0;
+        if (!strict_check_)
+        {
+            LOG_DEBUG("Kernel-side dump filtering is not available for pid={}: {}", pid_, strerror(errno));
+        }
+    }
+    if (bulk_acks_)
+    {
+        set_cap_ack();
+    }
+
+    if (nonblocking_)
+    {
+        stats_.syscalls++;
+        if (fcntl(nl_sock_, F_SETFL, fcntl(nl_sock_, F_GETFL) | O_NONBLOCK) < 0)
+        {
+            int fcntl_errno = errno;
+            close();
+            THROW_NETEX("Failed to set netlink socket non-blocking: {}", strerror(fcntl_errno));
+        }
+    }
+    for (unsigned int group : memberships_)
+    {
+        stats_.syscalls++;
+        if (setsockopt(nl_sock_, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)
+        {
+            int sockopt_errno = errno;
+            close();
+            THROW_NETEX("Failed to join netlink group={}: {}", group, strerror(sockopt_errno));
+        }
+    }
+    broken_ = false;
+
+    if (ring_)
+    {
+        if (ring_->get_buffer_len() < ring_buffer_len_)
+        {
+            ring_->register_buffers(RING_BUFFERS, ring_buffer_len_);
+        }
+        ring_arm();
     }
 }
 
-netlink::~netlink()
+void netlink::close()
 {
+    if (nl_sock_ < 0)
+    {
+        return;
+    }
     LOG_TRACE("Closing netlink socket with pid={}", pid_);
-    close(nl_sock_);
+    if (ring_)
+    {
+        ring_disarm();
+    }
+    stats_.syscalls++;
+    ::close(nl_sock_);
+    nl_sock_ = -1;
+
+    // Anything already received belongs to the old socket
+    for (const auto& completion : ring_ready_)
+    {
+        ring_->recycle_buffer(completion.buffer_id);
+    }
+    ring_ready_.clear();
+}
+
+void netlink::set_cap_ack()
+{
+    // Only saves receive traffic, so kernels before 4.3 that do not have it still work
+    int enable = bulk_acks_ ? 1 : 0;
+    stats_.syscalls++;
+    if (setsockopt(nl_sock_, SOL_NETLINK, NETLINK_CAP_ACK, &enable, sizeof(enable)) < 0)
+    {
+        LOG_DEBUG("Failed to set NETLINK_CAP_ACK for pid={}: {}", pid_, strerror(errno));
+    }
+}
+
+void netlink::reconnect()
+{
+    LOG_DEBUG("Reconnecting netlink socket with pid={}", pid_);
+    close();
+    open();
+}
+
+void netlink::set_bulk_acks(bool enable)
+{
+    if (bulk_acks_ == enable)
+    {
+        return;
+    }
+    bulk_acks_ = enable;
+    if (nl_sock_ >= 0)
+    {
+        set_cap_ack();
+    }
+}
+
+bool netlink::has_bulk_acks() const
+{
+    return bulk_acks_;
+}
+
+int netlink::get_protocol() const
+{
+    return protocol_;
+}
+
+int netlink::get_fd() const
+{
+    return nl_sock_;
+}
+
+uint32_t netlink::get_pid() const
+{
+    return pid_;
+}
+
+bool netlink::has_strict_check() const
+{
+    return strict_check_;
+}
+
+void netlink::set_timeout(std::chrono::milliseconds timeout)
+{
+    timeout_ = timeout;
+}
+
+std::chrono::milliseconds netlink::get_timeout() const
+{
+    return timeout_;
+}
+
+deadline netlink::get_deadline() const
+{
+    return scope_deadline_ ? *scope_deadline_ : deadline::after(timeout_);
+}
+
+void netlink::cancel()
+{
+    uint64_t one = 1;
+    if (write(cancel_fd_, &one, sizeof(one)) < 0)
+    {
+        THROW_NETEX("Failed to cancel netlink operation: {}", strerror(errno));
+    }
+}
+
+void netlink::set_nonblocking()
+{
+    if (nonblocking_)
+    {
+        return;
+    }
+    if (ring_)
+    {
+        THROWEX(illegal_argument, "A netlink session using io_uring cannot be non-blocking pid={}", pid_);
+    }
+    nonblocking_ = true;
+    stats_.syscalls++;
+    if (fcntl(nl_sock_, F_SETFL, fcntl(nl_sock_, F_GETFL) | O_NONBLOCK) < 0)
+    {
+        THROW_NETEX("Failed to set netlink socket non-blocking: {}", strerror(errno));
+    }
+}
+
+bool netlink::use_io_uring()
+{
+    if (ring_)
+    {
+        return true;
+    }
+    if (nonblocking_)
+    {
+        LOG_DEBUG("Not using io_uring for non-blocking netlink session with pid={}", pid_);
+        return false;
+    }
+
+    try
+    {
+        ring_ = std::make_unique<io_ring>(RING_ENTRIES);
+        ring_syscalls_ = 0;
+        ring_->register_buffers(RING_BUFFERS, ring_buffer_len_);
+
+        // Multishot receive needs a newer kernel than io_uring itself, so arm one and cancel it straight away to
+        // find out if it works
+        ring_arm();
+        ring_disarm();
+        if (!ring_ || ring_recv_error_ != 0)
+        {
+            THROW_NETEX("Multishot receive failed: {}", strerror(ring_recv_error_));
+        }
+        ring_arm();
+        ring_arm_wake();
+    }
+    catch (const network_exception& ex)
+    {
+        LOG_DEBUG("io_uring is not available for pid={}, using socket syscalls: {}", pid_, ex.what());
+        ring_.reset();
+        ring_armed_ = false;
+        ring_wake_armed_ = false;
+        ring_recv_error_ = 0;
+        ring_ready_.clear();
+        return false;
+    }
+    LOG_DEBUG("Using io_uring for netlink session with pid={}", pid_);
+    return true;
+}
+
+bool netlink::is_using_io_uring() const
+{
+    return ring_ != nullptr;
+}
+
+void netlink::record_to(const std::string& path)
+{
+    recorder_ = std::make_unique<netlink_recorder>(path);
+    LOG_DEBUG("Recording netlink traffic for pid={} to path={}", pid_, path);
+}
+
+void netlink::stop_recording()
+{
+    recorder_.reset();
+}
+
+void netlink::use_transport(std::unique_ptr<netlink_transport> transport)
+{
+    if (nonblocking_)
+    {
+        THROWEX(illegal_argument, "A non-blocking netlink session cannot use a transport pid={}", pid_);
+    }
+    close();
+    ring_.reset();
+    ring_armed_ = false;
+    ring_wake_armed_ = false;
+    transport_ = std::move(transport);
+    broken_ = false;
+    LOG_DEBUG("Using a transport instead of a socket for pid={}", pid_);
+}
+
+bool netlink::is_using_transport() const
+{
+    return transport_ != nullptr;
+}
+
+void netlink::replay(std::shared_ptr<const std::vector<netlink_record>> records)
+{
+    use_transport(std::make_unique<netlink_replay>(std::move(records), pid_));
+}
+
+void netlink::replay_from(const std::string& path)
+{
+    replay(std::make_shared<const std::vector<netlink_record>>(read_recording(path)));
+}
+
+void netlink::add_membership(unsigned int group)
+{
+    LOG_TRACE("Joining netlink group={} for pid={}", group, pid_);
+    stats_.syscalls++;
+    if (setsockopt(nl_sock_, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)
+    {
+        THROW_NETEX("Failed to join netlink group={}: {}", group, strerror(errno));
+    }
+    memberships_.push_back(group);
+}
+
+bool netlink::receive_available(const std::function<void (struct nlmsghdr*)>& handler)
+{
+    return receive(handler, deadline::never(), false);
+}
+
+bool netlink::receive_until(const std::function<void (struct nlmsghdr*)>& handler, const deadline& limit)
+{
+    struct pollfd fds[2];
+    fds[0].fd = nl_sock_;
+    fds[0].events = POLLIN;
+    fds[1].fd = cancel_fd_;
+    fds[1].events = POLLIN;
+
+    while (!receive(handler, limit, false))
+    {
+        if (limit.expired())
+        {
+            return false;
+        }
+        stats_.syscalls++;
+        int rc = poll(fds, 2, limit.remaining().count());
+        if (rc < 0 && errno != EINTR)
+        {
+            THROW_NETEX("Error waiting for netlink message: {}", strerror(errno));
+        }
+        if (rc > 0 && (fds[1].revents & POLLIN))
+        {
+            throw_cancelled();
+        }
+    }
+    return true;
+}
+
+const netlink_stats& netlink::get_stats() const
+{
+    return stats_;
 }
 
 nl_msg netlink::init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags)
+{
+    return make_message(nlmsg_type, nlmsg_flags, ++seq_, pid_);
+}
+
+nl_msg netlink::init_genl_message(uint16_t family_id, uint8_t cmd, uint8_t version, uint16_t nlmsg_flags)
+{
+    nl_msg message = make_message(family_id, nlmsg_flags, ++seq_, pid_, GENL_HDRLEN);
+    message.req.genl.cmd = cmd;
+    message.req.genl.version = version;
+    return message;
+}
+
+nl_msg netlink::make_message(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid)
+{
+    return make_message(nlmsg_type, nlmsg_flags, seq, pid, nl_header_len(nlmsg_type));
+}
+
+nl_msg netlink::make_message(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid, size_t header_len)
 {
     struct nl_msg message;
     memset(&message.kernel_sa, 0, sizeof(message.kernel_sa));
     memset(&message.rtnl_msg, 0, sizeof(message.rtnl_msg));
-    memset(&message.req, 0, sizeof(message.req));
+
+    // Only the headers are cleared, attributes are written into attrbuf as they are added
+    memset(&message.req, 0, NLMSG_LENGTH(header_len));
 
     message.kernel_sa.nl_family = AF_NETLINK;
 
-    message.req.hdr.nlmsg_seq = ++seq_;
-    message.req.hdr.nlmsg_pid = pid_;
+    message.req.hdr.nlmsg_len = NLMSG_LENGTH(header_len);
+    message.req.hdr.nlmsg_seq = seq;
+    message.req.hdr.nlmsg_pid = pid;
 
     message.req.hdr.nlmsg_flags = nlmsg_flags;
     message.req.hdr.nlmsg_type = nlmsg_type;
 
-    switch (nlmsg_type)
-    {
-        case RTM_NEWLINK:
-        case RTM_DELLINK:
-            message.req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-            break;
-        case RTM_GETLINK:
-            message.req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
-            break;
-
-        case RTM_NEWADDR:
-        case RTM_DELADDR:
-        case RTM_GETADDR:
-            message.req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-            break;
-
-        default:
-            THROW_NETEX("Unknown netlink message type={}", nlmsg_type);
-    }
-
     message.io.iov_base = &message.req;
     message.io.iov_len = message.req.hdr.nlmsg_len;
     message.rtnl_msg.msg_iov = &message.io;
@@ -104,72 +511,168 @@ nl_msg netlink::init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags)
     return message;
 }
 
+void netlink::init_message(netlink_builder& builder, uint16_t nlmsg_type, uint16_t nlmsg_flags)
+{
+    builder.begin(nlmsg_type, nlmsg_flags, ++seq_, pid_);
+}
+
+void nl_msg::add_attr(unsigned short type, const void* data, size_t len)
+{
+    size_t offset = NLMSG_ALIGN(req.hdr.nlmsg_len);
+    if (offset + RTA_LENGTH(len) > sizeof(req))
+    {
+        THROWEX(illegal_argument, "Attribute type={} len={} does not fit in the message", type, len);
+    }
+    struct rtattr* attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(&req) + offset);
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(attr), data, len);
+    req.hdr.nlmsg_len = offset + RTA_LENGTH(len);
+    io.iov_len = req.hdr.nlmsg_len;
+}
+
+void nl_msg::add_string(unsigned short type, std::string_view value)
+{
+    size_t offset = NLMSG_ALIGN(req.hdr.nlmsg_len);
+    if (offset + RTA_LENGTH(value.size() + 1) > sizeof(req))
+    {
+        THROWEX(illegal_argument, "Attribute type={} len={} does not fit in the message", type, value.size() + 1);
+    }
+    struct rtattr* attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(&req) + offset);
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(value.size() + 1);
+    char* data = static_cast<char*>(RTA_DATA(attr));
+    memcpy(data, value.data(), value.size());
+    data[value.size()] = '\0';
+    req.hdr.nlmsg_len = offset + RTA_LENGTH(value.size() + 1);
+    io.iov_len = req.hdr.nlmsg_len;
+}
+
 void netlink::send_message_sync(const nl_msg &msg, std::function<void (struct nlmsghdr*)> callback)
 {
+    // The request and its whole reply share one deadline
+    deadline_scope scope(*this, get_deadline());
     send_message_async(msg);
     handle_response_async(callback);
 }
 
 void netlink::send_message_sync(const nl_msg &msg)
 {
+    deadline_scope scope(*this, get_deadline());
     send_message_async(msg);
     handle_response_async();
 }
 
 void netlink::send_message_async(const nl_msg &msg)
 {
+    // A previous request failed part way through, so start over with a clean socket instead of
+    // sorting through whatever it left behind
+    if (broken_ || nl_sock_ < 0)
+    {
+        reconnect();
+    }
+
+    deadline limit = get_deadline();
+    if (limit.expired())
+    {
+        // Nothing is sent that could not be waited for, so a change is never made behind the caller's back
+        THROW_TIMEOUT("Deadline expired before sending netlink message pid={}", pid_);
+    }
     LOG_TRACE("Sending message for pid={} seq={}", msg.req.hdr.nlmsg_pid, msg.req.hdr.nlmsg_seq);
-    int rc = send(nl_sock_, &msg.req, msg.req.hdr.nlmsg_len, 0);
+    int rc = transmit(&msg.req, msg.req.hdr.nlmsg_len, limit);
 //    int rc = sendmsg(nl_sock_, (struct msghdr *) &msg.rtnl_msg, 0);
+    if (rc < 0 && (errno == EBADF || errno == ENOTCONN || errno == ECONNREFUSED || errno == EPIPE))
+    {
+        // The socket is no longer usable, retry once on a new one
+        LOG_DEBUG("Error sending netlink message, retrying on a new socket: {}", strerror(errno));
+        reconnect();
+        rc = transmit(&msg.req, msg.req.hdr.nlmsg_len, limit);
+    }
     if (rc < 0)
     {
         THROW_NETEX("Error sending netlink message: {}", strerror(errno));
     }
+    stats_.messages_sent++;
+    sent_seq_ = msg.req.hdr.nlmsg_seq;
 }
 
-void netlink::handle_response_async(std::function<void (struct nlmsghdr*)> callback)
+void netlink::send_messages_async(const std::vector<const struct nlmsghdr*>& requests)
 {
-    int BUFFER_LEN = 16384;
+    if (broken_ || nl_sock_ < 0)
+    {
+        reconnect();
+    }
+    deadline limit = get_deadline();
 
     struct sockaddr_nl kernel_sa;
     memset(&kernel_sa, 0, sizeof(kernel_sa));
     kernel_sa.nl_family = AF_NETLINK;
 
-    bool done = false;
-    char reply[BUFFER_LEN];
-    while (!done)
+    std::vector<struct iovec> iov;
+    iov.reserve(std::min(requests.size(), MAX_IN_FLIGHT));
+    size_t next = 0;
+    while (next < requests.size())
     {
-        int len;
-        struct msghdr rtnl_reply;
-        struct iovec io_reply;
-        memset(&io_reply, 0, sizeof(io_reply));
-        memset(&rtnl_reply, 0, sizeof(rtnl_reply));
+        iov.clear();
+        size_t batch_bytes = 0;
+        while (next < requests.size() && iov.size() < MAX_IN_FLIGHT && batch_bytes < MAX_BATCH_BYTES)
+        {
+            const struct nlmsghdr* hdr = requests[next++];
+            iov.push_back({ const_cast<struct nlmsghdr*>(hdr), NLMSG_ALIGN(hdr->nlmsg_len) });
+            batch_bytes += iov.back().iov_len;
+        }
 
-        io_reply.iov_base = reply;
-        io_reply.iov_len = BUFFER_LEN;
-        rtnl_reply.msg_iov = &io_reply;
-        rtnl_reply.msg_iovlen = 1;
-        rtnl_reply.msg_name = &kernel_sa;
-        rtnl_reply.msg_namelen = sizeof(kernel_sa);
+        struct msghdr batch;
+        memset(&batch, 0, sizeof(batch));
+        batch.msg_name = &kernel_sa;
+        batch.msg_namelen = sizeof(kernel_sa);
+        batch.msg_iov = iov.data();
+        batch.msg_iovlen = iov.size();
 
-        len = recvmsg(nl_sock_, &rtnl_reply, 0);
-        if (len < 0)
+        LOG_TRACE("Sending batch of {} messages for pid={}", iov.size(), pid_);
+        if (transmit(&batch, limit) < 0)
         {
-            if (errno == EWOULDBLOCK || errno == EAGAIN)
+            broken_ = true;
+            THROW_NETEX("Error sending netlink message batch: {}", strerror(errno));
+        }
+        stats_.messages_sent += iov.size();
+    }
+}
+
+void netlink::handle_response_async(std::function<void (struct nlmsghdr*)> callback)
+{
+    // Every part of a multi-part reply comes out of the same budget
+    deadline limit = get_deadline();
+    bool done = false;
+    bool interrupted = false;
+    while (!done)
+    {
+        receive([&](struct nlmsghdr* msg_ptr) {
+            if (done || msg_ptr->nlmsg_seq != sent_seq_)
             {
-                THROW_NETEX("Timeout waiting to receive netlink message");
+                // Left over from an earlier request on this session that was abandoned
+                LOG_TRACE("Discarding stale message for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
+                stats_.stale_messages++;
+                return;
+            }
+            if (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR)
+            {
+                interrupted = true;
             }
-            THROW_NETEX("Error receiving netlink message: {}", strerror(errno));
-        }
 
-        for (struct nlmsghdr *msg_ptr = (struct nlmsghdr *)reply; NLMSG_OK(msg_ptr, len); msg_ptr = NLMSG_NEXT(msg_ptr, len))
-        {
             switch(msg_ptr->nlmsg_type)
             {
                 case NLMSG_DONE:
+                {
                     LOG_TRACE("DONE recieved for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
                     done = true;
+                    int error = get_done_error(msg_ptr);
+                    if (error != 0)
+                    {
+                        throw_error(error);
+                    }
                     break;
+                }
 
                 case NLMSG_ERROR:
                 {
@@ -178,14 +681,10 @@ void netlink::handle_response_async(std::function<void (struct nlmsghdr*)> callb
                     {
                         // NLMSG_ERROR with the code set to 0 is a reply for a message that requested NLM_F_ACK
                         LOG_TRACE("ACK recieved for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
-                        return;
+                        done = true;
+                        break;
                     }
-                    else if (err->error == -13)
-                    {
-                        THROW_DENIED("Permission Denied");
-                    }
-
-                    THROW_NETEX("netlink error {}", strerror(-(err->error)));
+                    throw_error(-(err->error));
                 }
 
                 default:
@@ -195,8 +694,780 @@ void netlink::handle_response_async(std::function<void (struct nlmsghdr*)> callb
                     }
                     break;
             }
-        }
+        }, limit);
     }
+
+    // The whole dump has been read, so the socket is still good to use
+    if (interrupted)
+    {
+        stats_.dumps_interrupted++;
+        THROWEX(inconsistent_dump, "Netlink dump was interrupted by a change seq={}", sent_seq_);
+    }
+}
+
+void netlink::send_dump_sync(const nl_msg& msg, std::function<void()> reset, std::function<void(struct nlmsghdr*)> callback)
+{
+    stats_.dumps++;
+    last_dump_ = dump_stats();
+
+    // The retries and the waits between them all have to fit in the deadline of the dump
+    deadline_scope scope(*this, get_deadline());
+    deadline limit = get_deadline();
+
+    nl_msg attempt = msg;
+    auto delay = std::chrono::milliseconds(DUMP_BACKOFF_MS);
+    while (true)
+    {
+        last_dump_.attempts++;
+        last_dump_.messages = 0;
+        if (reset)
+        {
+            reset();
+        }
+        try
+        {
+            send_message_sync(attempt, [&](struct nlmsghdr* msg_ptr) {
+                last_dump_.messages++;
+                callback(msg_ptr);
+            });
+            return;
+        }
+        catch (const inconsistent_dump& ex)
+        {
+            if (broken_)
+            {
+                last_dump_.overflows++;
+            }
+            else
+            {
+                last_dump_.interrupted++;
+            }
+            if (last_dump_.attempts >= DUMP_ATTEMPTS)
+            {
+                throw;
+            }
+            if (!limit.is_never() && limit.remaining() <= delay)
+            {
+                THROW_TIMEOUT("No consistent netlink dump before the deadline after {} attempts: {}", last_dump_.attempts, ex.message);
+            }
+            LOG_DEBUG("Retrying netlink dump for pid={} in {}ms: {}", pid_, delay.count(), ex.message);
+        }
+
+        stats_.dump_retries++;
+        std::this_thread::sleep_for(delay);
+        delay *= 2;
+
+        // A retry is a new request, so replies to the old one are told apart from it
+        attempt.req.hdr.nlmsg_seq = ++seq_;
+        attempt.req.hdr.nlmsg_pid = pid_;
+    }
+}
+
+const dump_stats& netlink::get_last_dump() const
+{
+    return last_dump_;
+}
+
+std::vector<int> netlink::send_messages(const std::vector<nl_msg>& messages,
+                                        std::function<void(size_t, struct nlmsghdr*)> callback)
+{
+    return send_pipelined(messages.size(), [&](size_t idx) { return &messages[idx].req.hdr; }, callback);
+}
+
+std::vector<int> netlink::send_messages(const netlink_builder& builder,
+                                        std::function<void(size_t, struct nlmsghdr*)> callback)
+{
+    return send_pipelined(builder.count(), [&](size_t idx) { return builder.get_message(idx); }, callback);
+}
+
+std::vector<int> netlink::send_pipelined(size_t count,
+                                         const std::function<const struct nlmsghdr*(size_t)>& get_request,
+                                         const std::function<void(size_t, struct nlmsghdr*)>& callback)
+{
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        const struct nlmsghdr* hdr = get_request(idx);
+        if ((hdr->nlmsg_flags & (NLM_F_ACK | NLM_F_DUMP)) == 0)
+        {
+            THROWEX(illegal_argument, "Pipelined requests must set NLM_F_ACK or NLM_F_DUMP seq={}", hdr->nlmsg_seq);
+        }
+    }
+
+    if (broken_ || nl_sock_ < 0)
+    {
+        reconnect();
+    }
+    deadline limit = get_deadline();
+    if (limit.expired())
+    {
+        THROW_TIMEOUT("Deadline expired before sending netlink messages pid={}", pid_);
+    }
+    // Replies to these requests are matched through the pending table, not sent_seq_
+    sent_seq_ = 0;
+
+    std::vector<int> results(count, 0);
+    std::unordered_map<uint32_t, size_t> pending;
+    std::vector<struct iovec> iov;
+    iov.reserve(2 * MAX_IN_FLIGHT + 1);
+
+    // In bulk mode the requests go out without NLM_F_ACK through a copy of their header, and each batch ends with
+    // a barrier. The sequence numbers of the requests a barrier stands in for are kept in the order they were sent
+    std::vector<struct nlmsghdr> headers;
+    headers.reserve(MAX_IN_FLIGHT);
+    std::deque<uint32_t> unacked;
+    std::deque<std::pair<uint32_t, size_t>> barriers;
+    size_t unacked_sent = 0;
+    size_t window = bulk_acks_ ? MAX_IN_FLIGHT - 1 : MAX_IN_FLIGHT;
+
+    struct sockaddr_nl kernel_sa;
+    memset(&kernel_sa, 0, sizeof(kernel_sa));
+    kernel_sa.nl_family = AF_NETLINK;
+
+    // The kernel only runs one dump at a time on a socket and rejects another with EBUSY
+    uint32_t dump_seq = 0;
+
+    size_t next = 0;
+    while (next < count || !pending.empty() || !barriers.empty())
+    {
+        // Top up the window, writing all of the new requests with a single sendmsg. The window is bounded so the
+        // replies cannot overrun the socket receive buffer before we get around to reading them
+        iov.clear();
+        headers.clear();
+        size_t batch_count = 0;
+        size_t batch_bytes = 0;
+        while (next < count && pending.size() + batch_count < window && batch_bytes < MAX_BATCH_BYTES)
+        {
+            const struct nlmsghdr* hdr = get_request(next);
+            bool is_dump = (hdr->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+            if (is_dump)
+            {
+                if (dump_seq != 0)
+                {
+                    break;
+                }
+                dump_seq = hdr->nlmsg_seq;
+            }
+            if (bulk_acks_ && !is_dump)
+            {
+                headers.push_back(*hdr);
+                headers.back().nlmsg_flags &= ~NLM_F_ACK;
+                iov.push_back({ &headers.back(), sizeof(struct nlmsghdr) });
+                iov.push_back({ const_cast<char*>(reinterpret_cast<const char*>(hdr)) + sizeof(struct nlmsghdr),
+                                NLMSG_ALIGN(hdr->nlmsg_len) - sizeof(struct nlmsghdr) });
+                unacked.push_back(hdr->nlmsg_seq);
+            }
+            else
+            {
+                iov.push_back({ const_cast<struct nlmsghdr*>(hdr), NLMSG_ALIGN(hdr->nlmsg_len) });
+            }
+            batch_bytes += NLMSG_ALIGN(hdr->nlmsg_len);
+            batch_count++;
+            pending[hdr->nlmsg_seq] = next;
+            next++;
+        }
+
+        struct nlmsghdr barrier;
+        if (!headers.empty())
+        {
+            // The kernel acknowledges control messages without looking at them
+            memset(&barrier, 0, sizeof(barrier));
+            barrier.nlmsg_len = NLMSG_LENGTH(0);
+            barrier.nlmsg_type = NLMSG_NOOP;
+            barrier.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+            barrier.nlmsg_seq = ++seq_;
+            barrier.nlmsg_pid = pid_;
+            iov.push_back({ &barrier, sizeof(barrier) });
+            unacked_sent += headers.size();
+            barriers.emplace_back(barrier.nlmsg_seq, unacked_sent);
+            stats_.barriers++;
+        }
+        if (!iov.empty())
+        {
+            struct msghdr batch;
+            memset(&batch, 0, sizeof(batch));
+            batch.msg_name = &kernel_sa;
+            batch.msg_namelen = sizeof(kernel_sa);
+            batch.msg_iov = iov.data();
+            batch.msg_iovlen = iov.size();
+
+            LOG_TRACE("Sending batch of {} messages for pid={}", batch_count, pid_);
+            if (transmit(&batch, limit) < 0)
+            {
+                broken_ = true;
+                THROW_NETEX("Error sending netlink message batch: {}", strerror(errno));
+            }
+            stats_.messages_sent += batch_count + (headers.empty() ? 0 : 1);
+        }
+
+        receive([&](struct nlmsghdr* msg_ptr) {
+            if (!barriers.empty() && msg_ptr->nlmsg_seq == barriers.front().first)
+            {
+                // Every request before the barrier has been handled, and the ones that failed have said so already
+                size_t acked = unacked_sent - unacked.size();
+                while (acked < barriers.front().second)
+                {
+                    pending.erase(unacked.front());
+                    unacked.pop_front();
+                    acked++;
+                }
+                barriers.pop_front();
+                return;
+            }
+
+            auto it = pending.find(msg_ptr->nlmsg_seq);
+            if (it == pending.end())
+            {
+                LOG_TRACE("Discarding stale message for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
+                stats_.stale_messages++;
+                return;
+            }
+
+            switch (msg_ptr->nlmsg_type)
+            {
+                case NLMSG_DONE:
+                {
+                    if ((msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR) && results[it->second] != EINTR)
+                    {
+                        stats_.dumps_interrupted++;
+                        results[it->second] = EINTR;
+                    }
+                    int error = get_done_error(msg_ptr);
+                    if (error != 0)
+                    {
+                        results[it->second] = error;
+                    }
+                    pending.erase(it);
+                    if (dump_seq == msg_ptr->nlmsg_seq)
+                    {
+                        dump_seq = 0;
+                    }
+                    break;
+                }
+
+                case NLMSG_ERROR:
+                {
+                    struct nlmsgerr *err = reinterpret_cast<struct nlmsgerr*>(NLMSG_DATA(msg_ptr));
+                    results[it->second] = -(err->error);
+                    pending.erase(it);
+                    if (dump_seq == msg_ptr->nlmsg_seq)
+                    {
+                        dump_seq = 0;
+                    }
+                    break;
+                }
+
+                default:
+                    if (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR)
+                    {
+                        // Reported once the dump is finished, the caller can ask for it again
+                        if (results[it->second] != EINTR)
+                        {
+                            stats_.dumps_interrupted++;
+                        }
+                        results[it->second] = EINTR;
+                    }
+                    if (callback)
+                    {
+                        callback(it->second, msg_ptr);
+                    }
+                    break;
+            }
+        }, limit);
+    }
+
+    return results;
+}
+
+void netlink::throw_error(int error)
+{
+    if (error == EACCES)
+    {
+        THROW_DENIED("Permission Denied");
+    }
+    if (error == EINTR || error == ENOBUFS)
+    {
+        THROWEX(inconsistent_dump, "Netlink dump was inconsistent: {}", strerror(error));
+    }
+    THROW_NETEX("netlink error {}", strerror(error));
+}
+
+int netlink::get_done_error(const struct nlmsghdr* msg_ptr)
+{
+    if (msg_ptr->nlmsg_len < NLMSG_LENGTH(sizeof(int)))
+    {
+        return 0;
+    }
+    int error = *static_cast<const int*>(NLMSG_DATA(msg_ptr));
+    return error < 0 ? -error : 0;
+}
+
+void netlink::reserve_rx_buffers(size_t buffer_len)
+{
+    if (buffer_len <= rx_buffer_len_)
+    {
+        return;
+    }
+
+    // Grow geometrically so a session that sees a few large messages settles on a size and stops reallocating
+    size_t new_len = rx_buffer_len_ > 0 ? rx_buffer_len_ : RX_BUFFER_LEN;
+    while (new_len < buffer_len)
+    {
+        new_len *= 2;
+    }
+    if (rx_buffer_len_ > 0)
+    {
+        LOG_DEBUG("Growing netlink receive buffers from {} to {} bytes for pid={}", rx_buffer_len_, new_len, pid_);
+        stats_.buffer_grows++;
+    }
+    rx_buffer_len_ = new_len;
+
+    rx_pool_.resize(RX_BATCH * rx_buffer_len_);
+    rx_iov_.resize(RX_BATCH);
+    rx_msgs_.resize(RX_BATCH);
+    memset(rx_msgs_.data(), 0, rx_msgs_.size() * sizeof(struct mmsghdr));
+    for (size_t idx = 0; idx < RX_BATCH; ++idx)
+    {
+        rx_iov_[idx].iov_base = rx_pool_.data() + idx * rx_buffer_len_;
+        rx_iov_[idx].iov_len = rx_buffer_len_;
+        rx_msgs_[idx].msg_hdr.msg_iov = &rx_iov_[idx];
+        rx_msgs_[idx].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+bool netlink::receive(const std::function<void (struct nlmsghdr*)>& handler, const deadline& limit, bool wait)
+{
+    if (wait && limit.expired())
+    {
+        // The rest of the reply may still arrive later, so do not reuse this socket
+        broken_ = true;
+        THROW_TIMEOUT("Deadline expired waiting to receive netlink message pid={}", pid_);
+    }
+    if (transport_)
+    {
+        return transport_receive(handler, wait);
+    }
+    if (ring_)
+    {
+        return ring_receive(handler, limit, wait);
+    }
+
+    // Find out how big the next datagram is without consuming it, so the buffers can be grown to fit it instead of
+    // the kernel silently truncating it. The kernel answers most requests before send returns, so only wait for
+    // the socket when nothing is queued yet
+    ssize_t next_len;
+    while (true)
+    {
+        stats_.syscalls++;
+        stats_.recv_syscalls++;
+        next_len = recv(nl_sock_, nullptr, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+        if (next_len >= 0 || !(errno == EWOULDBLOCK || errno == EAGAIN))
+        {
+            break;
+        }
+        if (!wait)
+        {
+            return false;
+        }
+        wait_readable(limit);
+    }
+    if (next_len < 0)
+    {
+        broken_ = true;
+        throw_receive_error(errno);
+    }
+    reserve_rx_buffers(next_len);
+
+    // Take that datagram and whatever else is already queued
+    stats_.syscalls++;
+    stats_.recv_syscalls++;
+    int count = recvmmsg(nl_sock_, rx_msgs_.data(), rx_msgs_.size(), MSG_DONTWAIT, nullptr);
+    if (count < 0)
+    {
+        broken_ = true;
+        throw_receive_error(errno);
+    }
+
+    stats_.datagrams_received += count;
+    for (int idx = 0; idx < count; ++idx)
+    {
+        int len = rx_msgs_[idx].msg_len;
+        stats_.bytes_received += len;
+        if (rx_msgs_[idx].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+            // Only the first datagram is sized ahead of time, a later one in the same batch can still be too big.
+            // What was lost cannot be recovered, so fail loudly and make sure the next datagram fits
+            stats_.truncated++;
+            broken_ = true;
+            reserve_rx_buffers(rx_buffer_len_ + 1);
+            THROW_NETEX("Received a netlink message larger than the {} byte receive buffer", len);
+        }
+        if (recorder_)
+        {
+            recorder_->record(record_direction::received, rx_iov_[idx].iov_base, len);
+        }
+        for (struct nlmsghdr *msg_ptr = (struct nlmsghdr *)rx_iov_[idx].iov_base; NLMSG_OK(msg_ptr, len); msg_ptr = NLMSG_NEXT(msg_ptr, len))
+        {
+            stats_.messages_received++;
+            handler(msg_ptr);
+        }
+    }
+    return true;
+}
+
+void netlink::wait_readable(const deadline& limit)
+{
+    struct pollfd fds[2];
+    fds[0].fd = nl_sock_;
+    fds[0].events = POLLIN;
+    fds[1].fd = cancel_fd_;
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        stats_.syscalls++;
+        int rc = poll(fds, 2, limit.remaining().count());
+        if (rc < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rc < 0)
+        {
+            broken_ = true;
+            THROW_NETEX("Error waiting for netlink message: {}", strerror(errno));
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            throw_cancelled();
+        }
+        if (rc > 0)
+        {
+            return;
+        }
+        // The rest of the reply may still arrive later, so do not reuse this socket
+        broken_ = true;
+        THROW_TIMEOUT("Deadline expired waiting to receive netlink message pid={}", pid_);
+    }
+}
+
+void netlink::throw_cancelled()
+{
+    uint64_t count;
+    ring_cancelled_ = false;
+    stats_.syscalls++;
+    if (read(cancel_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        LOG_WARN("Failed to reset netlink cancel event for pid={}: {}", pid_, strerror(errno));
+    }
+    broken_ = true;
+    THROWEX(cancelled_exception, "Netlink operation was cancelled pid={}", pid_);
+}
+
+void netlink::throw_receive_error(int error)
+{
+    if (error == ENOBUFS)
+    {
+        // The kernel dropped replies because we did not read them fast enough. The socket is still usable,
+        // but whatever was being received is incomplete
+        stats_.rx_overflows++;
+        THROWEX(inconsistent_dump, "Netlink receive queue overflowed and replies were lost pid={}", pid_);
+    }
+    THROW_NETEX("Error receiving netlink message: {}", strerror(error));
+}
+
+ssize_t netlink::transmit(const void* buf, size_t len, const deadline& limit)
+{
+    ssize_t rc;
+    if (transport_)
+    {
+        transport_->send(buf, len);
+        rc = len;
+    }
+    else if (ring_)
+    {
+        ring_->prep_send(nl_sock_, buf, len, RING_SEND);
+        rc = ring_send(limit);
+    }
+    else
+    {
+        stats_.syscalls++;
+        rc = send(nl_sock_, buf, len, 0);
+    }
+    if (rc >= 0 && recorder_)
+    {
+        recorder_->record(record_direction::sent, buf, len);
+    }
+    return rc;
+}
+
+ssize_t netlink::transmit(const struct msghdr* msg, const deadline& limit)
+{
+    ssize_t rc;
+    if (transport_)
+    {
+        transport_->send(msg);
+        rc = 0;
+        for (size_t idx = 0; idx < msg->msg_iovlen; ++idx)
+        {
+            rc += msg->msg_iov[idx].iov_len;
+        }
+    }
+    else if (ring_)
+    {
+        ring_->prep_sendmsg(nl_sock_, msg, RING_SEND);
+        rc = ring_send(limit);
+    }
+    else
+    {
+        stats_.syscalls++;
+        rc = sendmsg(nl_sock_, msg, 0);
+    }
+    if (rc >= 0 && recorder_)
+    {
+        recorder_->record(record_direction::sent, msg);
+    }
+    return rc;
+}
+
+bool netlink::transport_receive(const std::function<void (struct nlmsghdr*)>& handler, bool wait)
+{
+    if (!transport_->receive(transport_buffer_))
+    {
+        if (!wait)
+        {
+            return false;
+        }
+        // Nothing more is coming, so waiting would only end in a timeout
+        broken_ = true;
+        THROW_NETEX("Netlink transport has no more replies pid={}", pid_);
+    }
+
+    // Take up to as many datagrams as a single recvmmsg would, so callers see the same batching as on a socket
+    size_t count = 0;
+    do
+    {
+        int len = transport_buffer_.size();
+        stats_.datagrams_received++;
+        stats_.bytes_received += len;
+        if (recorder_)
+        {
+            recorder_->record(record_direction::received, transport_buffer_.data(), len);
+        }
+        for (struct nlmsghdr *msg_ptr = (struct nlmsghdr *)transport_buffer_.data(); NLMSG_OK(msg_ptr, len); msg_ptr = NLMSG_NEXT(msg_ptr, len))
+        {
+            stats_.messages_received++;
+            handler(msg_ptr);
+        }
+    } while (++count < RX_BATCH && transport_->receive(transport_buffer_));
+    return true;
+}
+
+ssize_t netlink::ring_send(const deadline& limit)
+{
+    // Wait for the send to complete so the caller can reuse its buffer. The kernel handles rtnetlink requests
+    // inline, so the replies are usually already in the completion queue by then and need no syscall to receive
+    ring_send_done_ = false;
+    while (!ring_send_done_)
+    {
+        if (!ring_submit(1, limit))
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        ring_reap();
+    }
+    if (ring_send_result_ < 0)
+    {
+        errno = -ring_send_result_;
+        return -1;
+    }
+    return ring_send_result_;
+}
+
+bool netlink::ring_receive(const std::function<void (struct nlmsghdr*)>& handler, const deadline& limit, bool wait)
+{
+    ring_reap();
+    while (ring_ready_.empty() && ring_recv_error_ == 0)
+    {
+        if (wait && ring_cancelled_)
+        {
+            throw_cancelled();
+        }
+        if (!ring_armed_)
+        {
+            // The receive stops when it runs out of buffers, whatever it did not take is still queued on the socket
+            ring_arm();
+        }
+        if (!ring_wake_armed_)
+        {
+            ring_arm_wake();
+        }
+        stats_.recv_syscalls++;
+        if (!ring_submit(wait ? 1 : 0, limit))
+        {
+            // The rest of the reply may still arrive later, so do not reuse this socket
+            broken_ = true;
+            THROW_TIMEOUT("Deadline expired waiting to receive netlink message pid={}", pid_);
+        }
+        ring_reap();
+        if (!wait)
+        {
+            break;
+        }
+    }
+    if (ring_recv_error_ != 0)
+    {
+        int recv_errno = ring_recv_error_;
+        ring_recv_error_ = 0;
+        broken_ = true;
+        throw_receive_error(recv_errno);
+    }
+    if (ring_ready_.empty())
+    {
+        return false;
+    }
+
+    while (!ring_ready_.empty())
+    {
+        io_completion completion = ring_ready_.front();
+        ring_ready_.pop_front();
+
+        io_received received = ring_->get_received(completion);
+        stats_.datagrams_received++;
+        stats_.bytes_received += received.len;
+        if (received.full_len > received.len)
+        {
+            // Like the syscall path, what was lost cannot be recovered, so fail loudly and make sure the buffers
+            // registered for the next socket fit
+            ring_->recycle_buffer(completion.buffer_id);
+            stats_.truncated++;
+            broken_ = true;
+            while (ring_buffer_len_ < received.full_len)
+            {
+                ring_buffer_len_ *= 2;
+            }
+            THROW_NETEX("Received a netlink message larger than the {} byte receive buffer", received.len);
+        }
+
+        try
+        {
+            if (recorder_)
+            {
+                recorder_->record(record_direction::received, received.data, received.len);
+            }
+            int len = received.len;
+            for (struct nlmsghdr *msg_ptr = (struct nlmsghdr *)received.data; NLMSG_OK(msg_ptr, len); msg_ptr = NLMSG_NEXT(msg_ptr, len))
+            {
+                stats_.messages_received++;
+                handler(msg_ptr);
+            }
+        }
+        catch (...)
+        {
+            ring_->recycle_buffer(completion.buffer_id);
+            throw;
+        }
+        ring_->recycle_buffer(completion.buffer_id);
+    }
+    return true;
+}
+
+bool netlink::ring_submit(unsigned wait_nr, const deadline& limit)
+{
+    bool completed = ring_->submit(wait_nr, limit.remaining());
+    stats_.syscalls += ring_->get_syscalls() - ring_syscalls_;
+    ring_syscalls_ = ring_->get_syscalls();
+    return completed;
+}
+
+void netlink::ring_reap()
+{
+    io_completion completion;
+    while (ring_->next_completion(completion))
+    {
+        switch (completion.user_data)
+        {
+            case RING_SEND:
+                ring_send_result_ = completion.res;
+                ring_send_done_ = true;
+                break;
+
+            case RING_WAKE:
+                ring_wake_armed_ = false;
+                if (completion.res > 0)
+                {
+                    ring_cancelled_ = true;
+                }
+                break;
+
+            case RING_RECV:
+                if (!completion.more)
+                {
+                    ring_armed_ = false;
+                }
+                if (completion.res > 0 && completion.has_buffer)
+                {
+                    ring_ready_.push_back(completion);
+                    break;
+                }
+                if (completion.has_buffer)
+                {
+                    ring_->recycle_buffer(completion.buffer_id);
+                }
+                // Running out of buffers only stops the receive until it is armed again, and cancelling it is how
+                // it is disarmed. ENOBUFS while we are not holding every buffer is the socket reporting that its
+                // receive queue overflowed
+                if (completion.res == -ENOBUFS && ring_ready_.size() < ring_->get_buffer_count())
+                {
+                    ring_recv_error_ = ENOBUFS;
+                }
+                else if (completion.res < 0 && completion.res != -ENOBUFS && completion.res != -ECANCELED)
+                {
+                    ring_recv_error_ = -completion.res;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+void netlink::ring_arm()
+{
+    ring_->prep_recvmsg_multishot(nl_sock_, &ring_msg_, RING_RECV);
+    ring_armed_ = true;
+}
+
+void netlink::ring_disarm()
+{
+    if (!ring_armed_)
+    {
+        return;
+    }
+
+    // The receive has to be finished before its socket is closed or its buffers are replaced
+    ring_->prep_cancel(RING_RECV, RING_CANCEL);
+    deadline limit = deadline::after(DEFAULT_TIMEOUT);
+    while (ring_armed_)
+    {
+        if (!ring_submit(1, limit))
+        {
+            LOG_WARN("Timeout cancelling io_uring receive for pid={}, using socket syscalls", pid_);
+            ring_.reset();
+            ring_armed_ = false;
+            ring_wake_armed_ = false;
+            ring_ready_.clear();
+            return;
+        }
+        ring_reap();
+    }
+}
+
+void netlink::ring_arm_wake()
+{
+    // The receive can only wait on the ring, so the ring watches the cancel event too
+    ring_->prep_poll(cancel_fd_, POLLIN, RING_WAKE);
+    ring_wake_armed_ = true;
 }
 
 } // end namespace fnc
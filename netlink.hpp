@@ -1,13 +1,26 @@
 #pragma once
 
-#include <atomic>
+#include <linux/genetlink.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "io_ring.hpp"
+#include "netlink_builder.hpp"
+#include "netlink_record.hpp"
+#include "util/deadline.hpp"
 
 namespace fnc
 {
@@ -25,6 +38,7 @@ struct nl_req_t
     union
     {
         struct rtgenmsg rtgen;
+        struct genlmsghdr genl;
         struct ifaddrmsg ifaddr;
         struct ifinfomsg ifinfo;
     };
@@ -38,29 +52,518 @@ struct nl_msg
     struct iovec io;
     nl_req_t req;
     struct sockaddr_nl kernel_sa;
+
+    /**
+     * @brief Get the family header of the message, e.g. struct ifaddrmsg
+     */
+    template <typename T>
+    T* get_header()
+    {
+        return reinterpret_cast<T*>(NLMSG_DATA(&req.hdr));
+    }
+
+    /**
+     * @brief Append an attribute to the message
+     *
+     * Throws an illegal_argument if the attribute does not fit in attrbuf, use a netlink_builder for large messages
+     */
+    void add_attr(unsigned short type, const void* data, size_t len);
+
+    /**
+     * @brief Append a NUL terminated string attribute to the message, such as IFLA_IFNAME
+     */
+    void add_string(unsigned short type, std::string_view value);
+};
+
+/**
+ * @brief Counters for the socket activity of a netlink session
+ */
+struct netlink_stats
+{
+    uint64_t sockets_opened = 0;    ///< Number of sockets created (initial connect plus reconnects)
+    uint64_t syscalls = 0;          ///< Number of socket related syscalls made (socket, setsockopt, bind, send, recv, close)
+    uint64_t messages_sent = 0;     ///< Number of netlink requests sent
+    uint64_t stale_messages = 0;    ///< Number of replies discarded because they belonged to an earlier request
+    uint64_t recv_syscalls = 0;     ///< Number of receive syscalls made
+    uint64_t datagrams_received = 0;///< Number of datagrams read from the socket
+    uint64_t messages_received = 0; ///< Number of netlink messages read from the socket
+    uint64_t bytes_received = 0;    ///< Number of bytes read from the socket
+    uint64_t buffer_grows = 0;      ///< Number of times the receive buffers were enlarged to fit a datagram
+    uint64_t truncated = 0;         ///< Number of datagrams that did not fit in the receive buffers
+    uint64_t dumps = 0;             ///< Number of dumps requested through send_dump_sync
+    uint64_t dump_retries = 0;      ///< Number of times a dump was requested again because it was inconsistent
+    uint64_t dumps_interrupted = 0; ///< Number of dump replies the kernel marked with NLM_F_DUMP_INTR
+    uint64_t rx_overflows = 0;      ///< Number of times the socket receive queue overflowed and replies were lost
+    uint64_t barriers = 0;          ///< Number of barrier requests sent in place of the ACKs of pipelined requests
+};
+
+/**
+ * @brief What it took to get a consistent reply to a single dump
+ */
+struct dump_stats
+{
+    unsigned attempts = 0;          ///< Number of times the dump was requested, 1 if the first reply was consistent
+    unsigned interrupted = 0;       ///< Number of attempts the kernel marked with NLM_F_DUMP_INTR
+    unsigned overflows = 0;         ///< Number of attempts that lost replies to a receive queue overflow
+    uint64_t messages = 0;          ///< Number of messages received for the attempt that succeeded
 };
 
 class netlink
 {
 public:
-    const static time_t NL_SOCKET_TIMEOUT = 2;
+    constexpr static std::chrono::milliseconds DEFAULT_TIMEOUT{2000};  ///< Longest an operation may take unless the session or a deadline_scope says otherwise
+    constexpr static size_t MAX_IN_FLIGHT = 128;        ///< Most pipelined requests waiting for a reply at once
+    constexpr static size_t MAX_BATCH_BYTES = 65536;    ///< Most bytes of pipelined requests written per sendmsg
+    constexpr static size_t RX_BATCH = 8;               ///< Most datagrams read per receive syscall
+    constexpr static size_t RX_BUFFER_LEN = 32768;      ///< Initial size of each receive buffer, the largest datagram the kernel normally sends for a dump
+    constexpr static unsigned RING_ENTRIES = 16;        ///< Submission queue size of the io_uring transport
+    constexpr static unsigned RING_BUFFERS = 32;        ///< Number of receive buffers the io_uring transport hands to the kernel
+    constexpr static unsigned DUMP_ATTEMPTS = 5;        ///< Most times send_dump_sync asks for a dump before giving up
+    constexpr static unsigned DUMP_BACKOFF_MS = 10;     ///< Wait before asking for an inconsistent dump again, doubled for each retry
+
+    /**
+     * @brief Sets the deadline for every operation on a session while it is in scope
+     *
+     * Everything done on the session inside the scope, including all of the parts of multi-part replies and
+     * any retries, has to finish by the same deadline, and throws a timeout_exception if it does not. Scopes
+     * nest, and an inner scope can only make the deadline earlier, so a caller with a tight budget cannot be
+     * overruled by the code it calls.
+     *
+     * @example
+     * @code
+     * // Fail over within 50ms or not at all
+     * netlink::deadline_scope scope(nl, std::chrono::milliseconds(50));
+     * iface.set_ip_address(vip);
+     * @endcode
+     */
+    class deadline_scope
+    {
+    public:
+        /**
+         * Constructor
+         *
+         * @param session   the session to limit
+         * @param limit     the deadline for the operations in this scope
+         */
+        deadline_scope(netlink& session, const deadline& limit);
+
+        /**
+         * Constructor
+         *
+         * @param session   the session to limit
+         * @param budget    how long the operations in this scope may take, negative for no limit
+         */
+        deadline_scope(netlink& session, std::chrono::milliseconds budget);
+        ~deadline_scope();
 
-    netlink();
+        deadline_scope(const deadline_scope&) = delete;
+        deadline_scope& operator=(const deadline_scope&) = delete;
+
+    private:
+        netlink& session_;
+        std::optional<deadline> previous_;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param protocol  the netlink protocol to talk, NETLINK_ROUTE or NETLINK_GENERIC
+     */
+    explicit netlink(int protocol = NETLINK_ROUTE);
     virtual ~netlink();
 
+    netlink(const netlink&) = delete;
+    netlink& operator=(const netlink&) = delete;
+
+    /**
+     * @brief Get the long lived netlink session for the calling thread
+     *
+     * The session is created on first use and closed when the thread exits. It is not safe to share
+     * the returned object with other threads.
+     *
+     * @return the netlink session for this thread
+     */
+    static netlink& thread_session();
+
+    /**
+     * @brief Get the long lived generic netlink session for the calling thread
+     *
+     * @see thread_session
+     * @return the NETLINK_GENERIC session for this thread
+     */
+    static netlink& thread_generic_session();
+
+    /**
+     * @brief Get the netlink protocol of the session
+     *
+     * @return NETLINK_ROUTE or NETLINK_GENERIC
+     */
+    int get_protocol() const;
+
+    /**
+     * @brief Close the socket and open a new one
+     *
+     * Any replies still queued on the old socket are discarded
+     */
+    void reconnect();
+
+    /**
+     * @brief Get the file descriptor of the netlink socket, for use with poll/epoll
+     *
+     * The descriptor changes if the session reconnects
+     *
+     * @return the socket file descriptor
+     */
+    int get_fd() const;
+
+    /**
+     * @brief Get the netlink port ID the kernel assigned to the socket
+     *
+     * The port ID changes if the session reconnects
+     *
+     * @return the port ID
+     */
+    uint32_t get_pid() const;
+
+    /**
+     * @brief Check if the kernel filters dumps by the fields set in the request header (NETLINK_GET_STRICT_CHK)
+     *
+     * Without it, a dump returns every object of that type on the host, and the caller has to filter the replies
+     *
+     * @return true if strict checking is enabled on the socket
+     */
+    bool has_strict_check() const;
+
+    /**
+     * @brief Confirm pipelined requests with a single barrier per batch instead of an ACK for each one
+     *
+     * The kernel always answers a request that fails with an error, and only answers one that succeeds if it asks
+     * for an ACK. It also handles the requests on a socket in order. So in this mode send_messages sends requests
+     * without NLM_F_ACK and ends each batch with an NLMSG_NOOP barrier that does ask for one: any request before
+     * the barrier that has not failed by the time the barrier is acknowledged has succeeded. Dumps still end with
+     * NLMSG_DONE. The socket is also set to NETLINK_CAP_ACK so errors do not echo the whole request back. A large
+     * batch of changes then costs one reply per sendmsg instead of one per request.
+     *
+     * The mode is kept across reconnects. Requests sent one at a time are not affected, they wait for their own ACK.
+     *
+     * @param enable    true to use barriers, false to go back to an ACK for each request
+     */
+    void set_bulk_acks(bool enable);
+
+    /**
+     * @brief Check if pipelined requests are confirmed with barriers
+     *
+     * @see set_bulk_acks
+     */
+    bool has_bulk_acks() const;
+
+    /**
+     * @brief Set how long an operation may take when it is not inside a deadline_scope
+     *
+     * @param timeout   the time allowed for each operation, negative for no limit
+     */
+    void set_timeout(std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Get how long an operation may take when it is not inside a deadline_scope
+     */
+    std::chrono::milliseconds get_timeout() const;
+
+    /**
+     * @brief Get the deadline an operation started now has to finish by
+     *
+     * This is the deadline of the innermost deadline_scope, or the session timeout from now
+     */
+    deadline get_deadline() const;
+
+    /**
+     * @brief Abort whatever the session is waiting for
+     *
+     * This is the only method that is safe to call from another thread. The operation that is waiting, or the
+     * next one to wait if none is, throws a cancelled_exception, and the session reconnects before it is used
+     * again so no part of the abandoned reply is mistaken for a later one.
+     */
+    void cancel();
+
+    /**
+     * @brief Put the socket into non-blocking mode
+     *
+     * The mode is kept across reconnects
+     */
+    void set_nonblocking();
+
+    /**
+     * @brief Send and receive through io_uring instead of socket syscalls
+     *
+     * Requests are sent through an io_uring and replies are read by a multishot receive that stays armed on the
+     * socket, so a request and its reply usually cost a single io_uring_enter instead of a send and two receive
+     * syscalls. If io_uring or multishot receive is not available the session keeps using the socket syscalls.
+     * The choice is kept across reconnects. A session using io_uring cannot be put into non-blocking mode, and its
+     * socket cannot be watched with poll/epoll.
+     *
+     * @return true if the session is now using io_uring
+     */
+    bool use_io_uring();
+
+    /**
+     * @brief Check if the session is sending and receiving through io_uring
+     *
+     * @return true if the session is using io_uring
+     */
+    bool is_using_io_uring() const;
+
+    /**
+     * @brief Write every datagram the session sends and receives to a file
+     *
+     * The recording can be played back with replay_from to run the same client code offline. Recording
+     * replaces any earlier recording on this session
+     *
+     * @param path  the file to write
+     */
+    void record_to(const std::string& path);
+
+    /**
+     * @brief Stop recording and close the file
+     */
+    void stop_recording();
+
+    /**
+     * @brief Send requests to a transport instead of the kernel
+     *
+     * The socket is closed and every request from now on goes to the transport, and every reply comes from it.
+     * This is how a session replays a recording or talks to a netlink_emulator, so code that drives netiface can be
+     * run and benchmarked without root or real interfaces. Only the blocking path goes through a transport, so this
+     * cannot be combined with set_nonblocking, and a session using io_uring goes back to socket syscalls.
+     *
+     * @param transport     what to send requests to from now on
+     */
+    void use_transport(std::unique_ptr<netlink_transport> transport);
+
+    /**
+     * @brief Check if the session is sending requests to a transport instead of the kernel
+     *
+     * @return true if the session has no socket
+     */
+    bool is_using_transport() const;
+
+    /**
+     * @brief Answer requests from a recording instead of the kernel
+     *
+     * Every request from now on is matched against the recording, see netlink_replay, so code that parses dumps
+     * can be run against real captured traffic. A request the recording does not have throws a network_exception.
+     *
+     * @see use_transport
+     * @param records   the recording to play back, which can be shared with other sessions
+     */
+    void replay(std::shared_ptr<const std::vector<netlink_record>> records);
+
+    /**
+     * @brief Answer requests from a recording file instead of the kernel
+     *
+     * @see replay
+     * @param path  a file written by record_to
+     */
+    void replay_from(const std::string& path);
+
+    /**
+     * @brief Subscribe to an rtnetlink multicast group
+     *
+     * The membership is kept across reconnects
+     *
+     * @param group     the group to join, one of the RTNLGRP_* values
+     */
+    void add_membership(unsigned int group);
+
+    /**
+     * @brief Read whatever messages are already queued on the socket without waiting
+     *
+     * Messages are passed to the handler as they are read, without any matching to requests
+     *
+     * @param handler   called for every message read
+     * @return false if there was nothing to read
+     */
+    bool receive_available(const std::function<void(struct nlmsghdr*)>& handler);
+
+    /**
+     * @brief Read the messages queued on the socket, waiting for one to arrive if none are queued yet
+     *
+     * Like receive_available, but for a socket that only listens, so running out of time is not an error
+     *
+     * @param handler   called for every message read
+     * @param limit     how long to wait for a message
+     * @return false if nothing arrived before the deadline
+     */
+    bool receive_until(const std::function<void(struct nlmsghdr*)>& handler, const deadline& limit);
+
+    /**
+     * @brief Get the socket activity counters for this session
+     *
+     * @return the counters
+     */
+    const netlink_stats& get_stats() const;
+
     nl_msg init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags);
 
+    /**
+     * @brief Create a request message that does not belong to any session yet
+     *
+     * Unlike init_message this does not touch the session, so it is safe to call from any thread
+     *
+     * @param seq   the sequence number of the request
+     * @param pid   the port ID of the session that will send it
+     */
+    static nl_msg make_message(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid);
+
+    /**
+     * @brief Create a generic netlink request, with a genlmsghdr instead of an rtnetlink family header
+     *
+     * Look the family ID up with genl_family_cache instead of asking the kernel each time
+     *
+     * @param family_id the ID of the generic netlink family, GENL_ID_CTRL for the controller itself
+     * @param cmd       the command of the family
+     * @param version   the version of the family interface
+     */
+    nl_msg init_genl_message(uint16_t family_id, uint8_t cmd, uint8_t version, uint16_t nlmsg_flags);
+
+    /**
+     * @brief Start a new request in a batch, with the next sequence number of this session
+     *
+     * @param builder   the batch to add the request to
+     */
+    void init_message(netlink_builder& builder, uint16_t nlmsg_type, uint16_t nlmsg_flags);
+
     void send_message_sync(const nl_msg& msg, std::function<void(struct nlmsghdr*)> callback);
+
+    /**
+     * @brief Send a dump request and wait for a consistent reply
+     *
+     * If the objects change while they are being dumped or replies are lost to a receive queue overflow, the dump
+     * is asked for again with a growing delay between tries, up to DUMP_ATTEMPTS times. reset is called before every
+     * attempt so the caller can throw away whatever an earlier attempt collected. Throws an inconsistent_dump if
+     * no attempt was consistent, or a timeout_exception if the deadline would pass before the next attempt.
+     *
+     * @param msg       the dump request
+     * @param reset     called before each attempt
+     * @param callback  called for each message of the dump
+     */
+    void send_dump_sync(const nl_msg& msg, std::function<void()> reset, std::function<void(struct nlmsghdr*)> callback);
+
+    /**
+     * @brief Get what it took to get the most recent dump from send_dump_sync
+     */
+    const dump_stats& get_last_dump() const;
     void send_message_sync(const nl_msg& msg);
 
     void send_message_async(const nl_msg& msg);
+
+    /**
+     * @brief Send a batch of requests without waiting for any replies
+     *
+     * The requests are written back to back with as few sendmsg calls as possible, and the replies are left on
+     * the socket for receive_available. Like send_message_async, a broken socket is replaced first
+     *
+     * @param requests  the requests to send, in order
+     */
+    void send_messages_async(const std::vector<const struct nlmsghdr*>& requests);
     void handle_response_async(std::function<void(struct nlmsghdr*)> callback = nullptr);
 
+    /**
+     * @brief Send a batch of requests without waiting for each reply in turn
+     *
+     * Requests are written to the socket many at a time and each reply is matched back to the request it
+     * belongs to by sequence number, so a failure is reported against the request that caused it instead of
+     * aborting the batch. Every request must ask for an ACK (NLM_F_ACK) or be a dump (NLM_F_DUMP) so that its
+     * completion can be detected.
+     *
+     * @param messages  the requests to send
+     * @param callback  called for each data reply, with the index of the request it belongs to
+     * @return the result of each request in the same order as messages - 0 on success, otherwise an errno value
+     */
+    std::vector<int> send_messages(const std::vector<nl_msg>& messages,
+                                   std::function<void(size_t, struct nlmsghdr*)> callback = nullptr);
+
+    /**
+     * @brief Send a batch of requests built in a netlink_builder without waiting for each reply in turn
+     *
+     * @see send_messages
+     */
+    std::vector<int> send_messages(const netlink_builder& builder,
+                                   std::function<void(size_t, struct nlmsghdr*)> callback = nullptr);
+
+    /**
+     * @brief Throw the exception that corresponds to a netlink error code
+     *
+     * @param error     errno value from an NLMSG_ERROR reply
+     */
+    [[noreturn]] static void throw_error(int error);
+
+    /**
+     * @brief Get the error a dump finished with, from the int that follows an NLMSG_DONE header
+     *
+     * Kernels before 4.14 put the length of the last part there instead, which is never negative
+     *
+     * @param msg_ptr   the NLMSG_DONE message
+     * @return 0, or an errno value
+     */
+    static int get_done_error(const struct nlmsghdr* msg_ptr);
+
 private:
-    static std::atomic_int session_;
-    pid_t pid_;
+    int protocol_;
+    uint32_t pid_;
     int nl_sock_;
+    int cancel_fd_;
+    std::chrono::milliseconds timeout_;
+    std::optional<deadline> scope_deadline_;
     uint32_t seq_;
+    uint32_t sent_seq_;
+    bool broken_;
+    bool nonblocking_;
+    bool strict_check_;
+    bool bulk_acks_;
+    std::vector<unsigned int> memberships_;
+    netlink_stats stats_;
+    dump_stats last_dump_;
+    size_t rx_buffer_len_;
+    std::vector<char> rx_pool_;
+    std::vector<struct iovec> rx_iov_;
+    std::vector<struct mmsghdr> rx_msgs_;
+    std::unique_ptr<io_ring> ring_;
+    size_t ring_buffer_len_;
+    bool ring_armed_;
+    int ring_send_result_;
+    bool ring_send_done_;
+    int ring_recv_error_;
+    struct msghdr ring_msg_;
+    std::deque<io_completion> ring_ready_;
+    uint64_t ring_syscalls_;
+    bool ring_wake_armed_;
+    bool ring_cancelled_;
+    std::unique_ptr<netlink_recorder> recorder_;
+    std::unique_ptr<netlink_transport> transport_;
+    std::vector<char> transport_buffer_;
+
+    static nl_msg make_message(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid, size_t header_len);
+    void open();
+    void close();
+    void set_cap_ack();
+    bool receive(const std::function<void(struct nlmsghdr*)>& handler, const deadline& limit, bool wait = true);
+    void wait_readable(const deadline& limit);
+    [[noreturn]] void throw_cancelled();
+    void reserve_rx_buffers(size_t buffer_len);
+    [[noreturn]] void throw_receive_error(int error);
+    std::vector<int> send_pipelined(size_t count,
+                                    const std::function<const struct nlmsghdr*(size_t)>& get_request,
+                                    const std::function<void(size_t, struct nlmsghdr*)>& callback);
+    ssize_t transmit(const void* buf, size_t len, const deadline& limit);
+    ssize_t transmit(const struct msghdr* msg, const deadline& limit);
+    ssize_t ring_send(const deadline& limit);
+    bool ring_receive(const std::function<void(struct nlmsghdr*)>& handler, const deadline& limit, bool wait);
+    bool transport_receive(const std::function<void(struct nlmsghdr*)>& handler, bool wait);
+    bool ring_submit(unsigned wait_nr, const deadline& limit);
+    void ring_reap();
+    void ring_arm();
+    void ring_disarm();
+    void ring_arm_wake();
 };
 
 } // end namespace fnc
@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <string.h>
+
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "netlink_async.hpp"
+
+namespace fnc
+{
+
+netlink_async::netlink_async(event_loop& loop)
+    : loop_(loop),
+      registered_fd_(-1),
+      registered_socket_(0),
+      dump_seq_(0)
+{
+    nl_.set_nonblocking();
+    register_fd();
+}
+
+netlink_async::~netlink_async()
+{
+    loop_.remove(registered_fd_);
+    if (monitor_)
+    {
+        loop_.remove(monitor_->get_fd());
+    }
+}
+
+event_loop& netlink_async::get_loop()
+{
+    return loop_;
+}
+
+nl_msg netlink_async::init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags)
+{
+    return nl_.init_message(nlmsg_type, nlmsg_flags);
+}
+
+void netlink_async::submit(const nl_msg& msg, data_callback on_data, completion_callback on_complete)
+{
+    if ((msg.req.hdr.nlmsg_flags & (NLM_F_ACK | NLM_F_DUMP)) == 0)
+    {
+        THROWEX(illegal_argument, "Asynchronous requests must set NLM_F_ACK or NLM_F_DUMP seq={}", msg.req.hdr.nlmsg_seq);
+    }
+
+    request req { std::move(on_data), std::move(on_complete) };
+    if (!backlog_.empty() || !can_send(msg))
+    {
+        backlog_.emplace_back(msg, std::move(req));
+        return;
+    }
+    send(msg, std::move(req));
+}
+
+std::future<void> netlink_async::submit(const nl_msg& msg, data_callback on_data)
+{
+    auto result = std::make_shared<std::promise<void>>();
+    submit(msg, std::move(on_data), [result](int error) {
+        if (error == 0)
+        {
+            result->set_value();
+            return;
+        }
+        try
+        {
+            netlink::throw_error(error);
+        }
+        catch (...)
+        {
+            result->set_exception(std::current_exception());
+        }
+    });
+    return result->get_future();
+}
+
+void netlink_async::subscribe(const std::vector<unsigned int>& groups, data_callback handler)
+{
+    if (!monitor_)
+    {
+        monitor_ = std::make_unique<netlink>();
+        monitor_->set_nonblocking();
+        loop_.add(monitor_->get_fd(), EPOLLIN, [this](uint32_t) { on_notification(); });
+    }
+    for (unsigned int group : groups)
+    {
+        monitor_->add_membership(group);
+    }
+    notification_handler_ = std::move(handler);
+}
+
+size_t netlink_async::get_outstanding() const
+{
+    return pending_.size() + backlog_.size();
+}
+
+bool netlink_async::can_send(const nl_msg& msg) const
+{
+    // The kernel only runs one dump at a time on a socket and rejects another with EBUSY
+    bool is_dump = (msg.req.hdr.nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+    return pending_.size() < netlink::MAX_IN_FLIGHT && !(is_dump && dump_seq_ != 0);
+}
+
+void netlink_async::send(const nl_msg& msg, request&& req)
+{
+    uint32_t seq = msg.req.hdr.nlmsg_seq;
+    pending_.emplace(seq, std::move(req));
+    if ((msg.req.hdr.nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP)
+    {
+        dump_seq_ = seq;
+    }
+    try
+    {
+        nl_.send_message_async(msg);
+    }
+    catch (const fnc_exception&)
+    {
+        auto it = pending_.find(seq);
+        request failed = std::move(it->second);
+        pending_.erase(it);
+        if (dump_seq_ == seq)
+        {
+            dump_seq_ = 0;
+        }
+        failed.on_complete(EIO);
+    }
+
+    // Sending may have replaced a broken socket, possibly with one that reuses the same descriptor number
+    if (nl_.get_stats().sockets_opened != registered_socket_)
+    {
+        loop_.remove(registered_fd_);
+        register_fd();
+    }
+}
+
+void netlink_async::register_fd()
+{
+    registered_fd_ = nl_.get_fd();
+    registered_socket_ = nl_.get_stats().sockets_opened;
+    loop_.add(registered_fd_, EPOLLIN, [this](uint32_t) { on_readable(); });
+}
+
+void netlink_async::on_readable()
+{
+    // Completions are collected and run after the socket is drained so a callback that submits more requests
+    // does not change the pending table underneath the receive loop
+    std::vector<std::pair<request, int>> completed;
+    try
+    {
+        while (nl_.receive_available([&](struct nlmsghdr* msg_ptr) {
+            auto it = pending_.find(msg_ptr->nlmsg_seq);
+            if (it == pending_.end())
+            {
+                LOG_TRACE("Discarding stale message for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
+                return;
+            }
+
+            switch (msg_ptr->nlmsg_type)
+            {
+                case NLMSG_DONE:
+                {
+                    bool interrupted = it->second.interrupted || (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR);
+                    int error = netlink::get_done_error(msg_ptr);
+                    completed.emplace_back(std::move(it->second), error != 0 ? error : (interrupted ? EINTR : 0));
+                    pending_.erase(it);
+                    if (dump_seq_ == msg_ptr->nlmsg_seq)
+                    {
+                        dump_seq_ = 0;
+                    }
+                    break;
+                }
+
+                case NLMSG_ERROR:
+                {
+                    struct nlmsgerr *err = reinterpret_cast<struct nlmsgerr*>(NLMSG_DATA(msg_ptr));
+                    completed.emplace_back(std::move(it->second), -(err->error));
+                    pending_.erase(it);
+                    if (dump_seq_ == msg_ptr->nlmsg_seq)
+                    {
+                        dump_seq_ = 0;
+                    }
+                    break;
+                }
+
+                default:
+                    if (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR)
+                    {
+                        it->second.interrupted = true;
+                    }
+                    if (it->second.on_data)
+                    {
+                        it->second.on_data(msg_ptr);
+                    }
+                    break;
+            }
+        }))
+        { }
+    }
+    catch (const fnc_exception& ex)
+    {
+        // Replies may have been lost, so nothing that is waiting can be trusted to complete
+        LOG_DEBUG("Failed to receive netlink replies: {}", ex.what());
+        for (auto& item : completed)
+        {
+            item.first.on_complete(item.second);
+        }
+        completed.clear();
+        fail_all(dynamic_cast<const inconsistent_dump*>(&ex) ? ENOBUFS : EIO);
+    }
+
+    for (auto& item : completed)
+    {
+        item.first.on_complete(item.second);
+    }
+
+    while (!backlog_.empty() && can_send(backlog_.front().first))
+    {
+        auto next = std::move(backlog_.front());
+        backlog_.pop_front();
+        send(next.first, std::move(next.second));
+    }
+}
+
+void netlink_async::on_notification()
+{
+    try
+    {
+        while (monitor_->receive_available([&](struct nlmsghdr* msg_ptr) {
+            if (notification_handler_)
+            {
+                notification_handler_(msg_ptr);
+            }
+        }))
+        { }
+    }
+    catch (const inconsistent_dump& ex)
+    {
+        // Whoever is tracking state from the notifications has missed some of them and needs to dump it again
+        LOG_WARN("Netlink notifications were lost, state must be resynchronized: {}", ex.what());
+    }
+    catch (const fnc_exception& ex)
+    {
+        LOG_WARN("Failed to receive netlink notifications: {}", ex.what());
+    }
+}
+
+void netlink_async::fail_all(int error)
+{
+    std::unordered_map<uint32_t, request> failed;
+    failed.swap(pending_);
+    dump_seq_ = 0;
+    for (auto& item : failed)
+    {
+        item.second.on_complete(error);
+    }
+}
+
+} // end namespace fnc
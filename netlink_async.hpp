@@ -0,0 +1,119 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.hpp"
+#include "netlink.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Non-blocking netlink session driven by an event_loop
+ *
+ * Requests are submitted without waiting and complete from the event loop, so any number of requests on any
+ * number of sessions can be outstanding at once while one thread services all of them. Each session owns its
+ * own socket. Like the event loop itself, a session must only be used from the thread that runs the loop.
+ */
+class netlink_async
+{
+public:
+    using data_callback = std::function<void(struct nlmsghdr*)>;
+    using completion_callback = std::function<void(int error)>;
+
+    /**
+     * Constructor
+     *
+     * @param loop  the event loop that drives this session
+     */
+    netlink_async(event_loop& loop);
+    virtual ~netlink_async();
+
+    netlink_async(const netlink_async&) = delete;
+    netlink_async& operator=(const netlink_async&) = delete;
+
+    /**
+     * @brief Get the event loop that drives this session
+     */
+    event_loop& get_loop();
+
+    /**
+     * @brief Create a request message for this session
+     *
+     * @see netlink::init_message
+     */
+    nl_msg init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags);
+
+    /**
+     * @brief Submit a request and get a callback when it completes
+     *
+     * The request must ask for an ACK (NLM_F_ACK) or be a dump (NLM_F_DUMP) so that its completion can be
+     * detected. If too many requests are already waiting for a reply, or it is a dump and another dump is still
+     * running on this session, it is queued and sent in order when there is room.
+     *
+     * @param msg           the request to send
+     * @param on_data       called for each data reply to the request
+     * @param on_complete   called once when the request is finished, with 0 on success or an errno value. A dump
+     *                      that was interrupted by a change finishes with EINTR, and requests whose replies were
+     *                      lost to a receive queue overflow with ENOBUFS, and can be submitted again
+     */
+    void submit(const nl_msg& msg, data_callback on_data, completion_callback on_complete);
+
+    /**
+     * @brief Submit a request and get a future for its completion
+     *
+     * @param msg       the request to send
+     * @param on_data   called for each data reply to the request
+     * @return a future that becomes ready when the request is finished, and throws if the request failed
+     */
+    std::future<void> submit(const nl_msg& msg, data_callback on_data = nullptr);
+
+    /**
+     * @brief Receive notifications from rtnetlink multicast groups
+     *
+     * Notifications are read from a separate socket so they are never confused with replies to requests
+     *
+     * @param groups    the groups to join, RTNLGRP_* values
+     * @param handler   called for each notification, replacing any previous handler
+     */
+    void subscribe(const std::vector<unsigned int>& groups, data_callback handler);
+
+    /**
+     * @brief Get the number of requests that have not completed yet, including queued ones
+     *
+     * @return the number of incomplete requests
+     */
+    size_t get_outstanding() const;
+
+private:
+    struct request
+    {
+        data_callback on_data;
+        completion_callback on_complete;
+        bool interrupted = false;
+    };
+
+    event_loop& loop_;
+    netlink nl_;
+    int registered_fd_;
+    uint64_t registered_socket_;
+    std::unordered_map<uint32_t, request> pending_;
+    uint32_t dump_seq_;
+    std::deque<std::pair<nl_msg, request>> backlog_;
+    std::unique_ptr<netlink> monitor_;
+    data_callback notification_handler_;
+
+    bool can_send(const nl_msg& msg) const;
+    void send(const nl_msg& msg, request&& req);
+    void on_readable();
+    void on_notification();
+    void fail_all(int error);
+    void register_fd();
+};
+
+} // end namespace fnc
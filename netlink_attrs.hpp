@@ -0,0 +1,118 @@
+#pragma once
+
+#include <linux/rtnetlink.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+
+namespace fnc
+{
+
+/**
+ * @brief A view of the payload of an attribute, which points into the received message
+ */
+struct attr_bytes
+{
+    const uint8_t* data = nullptr;
+    size_t len = 0;
+
+    bool empty() const { return data == nullptr; }
+};
+
+/**
+ * @brief Index of the attributes of a netlink message by type, built in a single pass
+ *
+ * Like nla_parse in the kernel, this only records where each attribute is, so looking one up afterwards is an
+ * array access and nothing is copied or allocated. The typed getters return views that point into the message,
+ * so the table must not outlive it. Attributes with a type above MaxType are skipped, and if a type appears more
+ * than once the last one wins.
+ *
+ * @tparam MaxType  the highest attribute type to keep, e.g. IFLA_MAX
+ */
+template <unsigned short MaxType>
+class attr_table
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param first     the first attribute of the message, e.g. IFLA_RTA(ifinfo)
+     * @param len       the number of bytes of attributes, from the first one to the end of the message
+     */
+    attr_table(const struct rtattr* first, int len)
+        : attrs_{}
+    {
+        for (const struct rtattr* attr = first; RTA_OK(attr, len); attr = RTA_NEXT(attr, len))
+        {
+            unsigned short type = attr->rta_type & NLA_TYPE_MASK;
+            if (type <= MaxType)
+            {
+                attrs_[type] = attr;
+            }
+        }
+    }
+
+    /**
+     * @brief Check if the message has an attribute
+     */
+    bool has(unsigned short type) const
+    {
+        return type <= MaxType && attrs_[type] != nullptr;
+    }
+
+    /**
+     * @brief Get the payload of an attribute
+     *
+     * @return the payload, empty if the message does not have the attribute
+     */
+    attr_bytes get_bytes(unsigned short type) const
+    {
+        attr_bytes bytes;
+        if (has(type))
+        {
+            bytes.data = static_cast<const uint8_t*>(RTA_DATA(attrs_[type]));
+            bytes.len = RTA_PAYLOAD(attrs_[type]);
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief Get a NUL terminated string attribute, such as IFLA_IFNAME
+     *
+     * @return the string without its terminator, empty if the message does not have the attribute
+     */
+    std::string_view get_string(unsigned short type) const
+    {
+        attr_bytes bytes = get_bytes(type);
+        if (bytes.empty())
+        {
+            return std::string_view();
+        }
+        const char* str = reinterpret_cast<const char*>(bytes.data);
+        return std::string_view(str, strnlen(str, bytes.len));
+    }
+
+    /**
+     * @brief Get a fixed size attribute, such as IFLA_MTU
+     *
+     * @param value     set to the value of the attribute, if the message has it and it is the right size
+     * @return true if value was set
+     */
+    template <typename T>
+    bool get(unsigned short type, T& value) const
+    {
+        attr_bytes bytes = get_bytes(type);
+        if (bytes.len < sizeof(T))
+        {
+            return false;
+        }
+        memcpy(&value, bytes.data, sizeof(T));
+        return true;
+    }
+
+private:
+    const struct rtattr* attrs_[MaxType + 1];
+};
+
+} // end namespace fnc
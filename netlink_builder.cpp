@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <linux/rtnetlink.h>
+#include <string.h>
+
+#include "exceptions.hpp"
+#include "netlink_builder.hpp"
+
+namespace fnc
+{
+
+size_t nl_header_len(uint16_t nlmsg_type)
+{
+    switch (nlmsg_type)
+    {
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+        case RTM_GETLINK:
+            // A strictly checked link dump must have a whole ifinfomsg, not just an rtgenmsg
+            return sizeof(struct ifinfomsg);
+
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+        case RTM_GETADDR:
+            return sizeof(struct ifaddrmsg);
+
+        case NLMSG_DONE:
+            return sizeof(int);
+
+        case NLMSG_ERROR:
+            return sizeof(struct nlmsgerr);
+
+        default:
+            THROW_NETEX("Unknown netlink message type={}", nlmsg_type);
+    }
+}
+
+netlink_builder::netlink_builder(size_t capacity)
+    : buffer_(capacity),
+      len_(0)
+{ }
+
+void netlink_builder::begin(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid)
+{
+    size_t header_len = nl_header_len(nlmsg_type);
+    size_t offset = len_;
+    char* start = append(NLMSG_LENGTH(header_len));
+    memset(start, 0, NLMSG_LENGTH(header_len));
+    offsets_.push_back(offset);
+
+    struct nlmsghdr* hdr = reinterpret_cast<struct nlmsghdr*>(start);
+    hdr->nlmsg_len = NLMSG_LENGTH(header_len);
+    hdr->nlmsg_type = nlmsg_type;
+    hdr->nlmsg_flags = nlmsg_flags;
+    hdr->nlmsg_seq = seq;
+    hdr->nlmsg_pid = pid;
+}
+
+void netlink_builder::add_attr(unsigned short type, const void* data, size_t len)
+{
+    if (offsets_.empty())
+    {
+        THROWEX(illegal_argument, "Attribute type={} added before any message was started", type);
+    }
+    struct rtattr* attr = reinterpret_cast<struct rtattr*>(append(RTA_LENGTH(len)));
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(len);
+    if (len > 0)
+    {
+        memcpy(RTA_DATA(attr), data, len);
+    }
+    update_len();
+}
+
+void netlink_builder::add_string(unsigned short type, std::string_view value)
+{
+    if (offsets_.empty())
+    {
+        THROWEX(illegal_argument, "Attribute type={} added before any message was started", type);
+    }
+    struct rtattr* attr = reinterpret_cast<struct rtattr*>(append(RTA_LENGTH(value.size() + 1)));
+    attr->rta_type = type;
+    attr->rta_len = RTA_LENGTH(value.size() + 1);
+    char* data = static_cast<char*>(RTA_DATA(attr));
+    memcpy(data, value.data(), value.size());
+    data[value.size()] = '\0';
+    update_len();
+}
+
+size_t netlink_builder::begin_nested(unsigned short type)
+{
+    size_t nested = len_;
+    add_attr(type, nullptr, 0);
+    return nested;
+}
+
+void netlink_builder::end_nested(size_t nested)
+{
+    reinterpret_cast<struct rtattr*>(buffer_.data() + nested)->rta_len = len_ - nested;
+}
+
+void netlink_builder::clear()
+{
+    len_ = 0;
+    offsets_.clear();
+}
+
+size_t netlink_builder::count() const
+{
+    return offsets_.size();
+}
+
+size_t netlink_builder::size() const
+{
+    return len_;
+}
+
+struct nlmsghdr* netlink_builder::get_message(size_t idx)
+{
+    return reinterpret_cast<struct nlmsghdr*>(buffer_.data() + offsets_[idx]);
+}
+
+const struct nlmsghdr* netlink_builder::get_message(size_t idx) const
+{
+    return reinterpret_cast<const struct nlmsghdr*>(buffer_.data() + offsets_[idx]);
+}
+
+char* netlink_builder::append(size_t len)
+{
+    // Messages and attributes all start on a 4 byte boundary, and the padding is zeroed so nothing stale is sent
+    size_t aligned_len = NLMSG_ALIGN(len);
+    if (len_ + aligned_len > buffer_.size())
+    {
+        buffer_.resize(std::max(buffer_.size() * 2, len_ + aligned_len));
+    }
+    char* start = buffer_.data() + len_;
+    memset(start + len, 0, aligned_len - len);
+    len_ += aligned_len;
+    return start;
+}
+
+void netlink_builder::update_len()
+{
+    struct nlmsghdr* hdr = get_message(offsets_.size() - 1);
+    hdr->nlmsg_len = buffer_.data() + len_ - reinterpret_cast<char*>(hdr);
+}
+
+} // end namespace fnc
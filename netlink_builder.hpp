@@ -0,0 +1,115 @@
+#pragma once
+
+#include <linux/netlink.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+namespace fnc
+{
+
+/**
+ * @brief Get the size of the family header that follows the nlmsghdr for a message type
+ *
+ * Throws a network_exception for message types that netlink does not know how to build
+ */
+size_t nl_header_len(uint16_t nlmsg_type);
+
+/**
+ * @brief Builds a batch of netlink requests back to back in one growable buffer
+ *
+ * Each message is started with begin() and attributes are appended to the most recent one, including nested
+ * attributes such as IFLA_LINKINFO. The buffer only grows, so after clear() the next batch is built without any
+ * allocation, and only the bytes that are written are initialized. Pointers returned by get_header() and
+ * get_message() are invalidated by anything that appends, so look them up again instead of holding on to them.
+ *
+ * Use netlink::init_message to start a message with the sequence number and port of a session, and
+ * netlink::send_messages to send the whole batch.
+ */
+class netlink_builder
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param capacity  the number of bytes to allocate up front
+     */
+    netlink_builder(size_t capacity = 4096);
+
+    /**
+     * @brief Start a new message, with a zeroed family header sized for its type
+     */
+    void begin(uint16_t nlmsg_type, uint16_t nlmsg_flags, uint32_t seq, uint32_t pid);
+
+    /**
+     * @brief Get the family header of the current message, e.g. struct ifaddrmsg
+     */
+    template <typename T>
+    T* get_header()
+    {
+        return reinterpret_cast<T*>(NLMSG_DATA(get_message(offsets_.size() - 1)));
+    }
+
+    /**
+     * @brief Append an attribute to the current message
+     */
+    void add_attr(unsigned short type, const void* data, size_t len);
+
+    /**
+     * @brief Append a NUL terminated string attribute to the current message, such as IFLA_IFNAME
+     */
+    void add_string(unsigned short type, std::string_view value);
+
+    /**
+     * @brief Append a fixed size attribute to the current message, such as IFLA_MTU
+     */
+    template <typename T>
+    void add(unsigned short type, const T& value)
+    {
+        add_attr(type, &value, sizeof(value));
+    }
+
+    /**
+     * @brief Start a nested attribute. Attributes added until end_nested() go inside it
+     *
+     * @return a handle to pass to end_nested()
+     */
+    size_t begin_nested(unsigned short type);
+
+    /**
+     * @brief Finish a nested attribute started by begin_nested()
+     */
+    void end_nested(size_t nested);
+
+    /**
+     * @brief Remove all of the messages, keeping the buffer for the next batch
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of messages in the batch
+     */
+    size_t count() const;
+
+    /**
+     * @brief Get the number of bytes in the batch, which start at the first message
+     */
+    size_t size() const;
+
+    /**
+     * @brief Get a message of the batch
+     */
+    struct nlmsghdr* get_message(size_t idx);
+    const struct nlmsghdr* get_message(size_t idx) const;
+
+private:
+    std::vector<char> buffer_;
+    size_t len_;
+    std::vector<size_t> offsets_;
+
+    char* append(size_t len);
+    void update_len();
+};
+
+} // end namespace fnc
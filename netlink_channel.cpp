@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "netlink_channel.hpp"
+
+namespace fnc
+{
+
+netlink_channel::netlink_channel()
+    : wake_fd_(-1),
+      submitted_(nullptr),
+      stopping_(false),
+      requests_(0),
+      batches_(0),
+      wakeups_(0),
+      table_(TABLE_SIZE),
+      in_flight_(0),
+      next_seq_(0),
+      dump_seq_(0)
+{
+    nl_.set_nonblocking();
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd_ < 0)
+    {
+        THROW_NETEX("Failed to create netlink channel wake event: {}", strerror(errno));
+    }
+    io_thread_ = std::thread([this] { run(); });
+}
+
+netlink_channel::~netlink_channel()
+{
+    stopping_.store(true, std::memory_order_release);
+    wake();
+    io_thread_.join();
+
+    // Nothing is left to send or receive them, so whoever is waiting has to be told
+    take_submitted();
+    fail_all(ECANCELED);
+    for (auto& req : backlog_)
+    {
+        complete(*req, ECANCELED);
+    }
+    backlog_.clear();
+    close(wake_fd_);
+}
+
+nl_msg netlink_channel::init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags)
+{
+    return netlink::make_message(nlmsg_type, nlmsg_flags, 0, 0);
+}
+
+std::future<void> netlink_channel::submit(const nl_msg& msg, data_callback on_data, const deadline& limit)
+{
+    if ((msg.req.hdr.nlmsg_flags & (NLM_F_ACK | NLM_F_DUMP)) == 0)
+    {
+        THROWEX(illegal_argument, "Channel requests must set NLM_F_ACK or NLM_F_DUMP type={}", msg.req.hdr.nlmsg_type);
+    }
+
+    auto req = std::make_unique<request>();
+    req->msg = msg;
+    req->on_data = std::move(on_data);
+    req->limit = limit;
+    std::future<void> result = req->result.get_future();
+    requests_.fetch_add(1, std::memory_order_relaxed);
+
+    // Push onto the lock-free stack. Only the request that finds it empty has to wake the I/O thread, because
+    // the I/O thread takes the whole stack at once after it wakes up. The node belongs to the I/O thread as soon
+    // as it is pushed, so only the head that was replaced is looked at afterwards
+    request* node = req.release();
+    request* head = submitted_.load(std::memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (!submitted_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    if (head == nullptr)
+    {
+        wake();
+    }
+    return result;
+}
+
+void netlink_channel::send_message_sync(const nl_msg& msg, data_callback on_data, const deadline& limit)
+{
+    submit(msg, std::move(on_data), limit).get();
+}
+
+channel_stats netlink_channel::get_stats() const
+{
+    channel_stats stats;
+    stats.requests = requests_.load(std::memory_order_relaxed);
+    stats.batches = batches_.load(std::memory_order_relaxed);
+    stats.wakeups = wakeups_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void netlink_channel::wake()
+{
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        LOG_WARN("Failed to wake netlink channel: {}", strerror(errno));
+    }
+}
+
+void netlink_channel::run()
+{
+    while (!stopping_.load(std::memory_order_acquire))
+    {
+        struct pollfd fds[2];
+        fds[0].fd = nl_.get_fd();
+        fds[0].events = POLLIN;
+        fds[1].fd = wake_fd_;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, next_timeout().count()) < 0 && errno != EINTR)
+        {
+            LOG_WARN("Failed to wait for netlink channel: {}", strerror(errno));
+            continue;
+        }
+        wakeups_.fetch_add(1, std::memory_order_relaxed);
+        if (fds[1].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(wake_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            {
+                LOG_WARN("Failed to reset netlink channel wake event: {}", strerror(errno));
+            }
+        }
+
+        try
+        {
+            // The kernel answers most requests before sendmsg returns, so the replies are read straight after
+            // the batch is written, and whatever they free up in the window goes out in the next batch
+            take_submitted();
+            send_backlog();
+            receive_replies();
+            expire();
+            send_backlog();
+        }
+        catch (const fnc_exception& ex)
+        {
+            LOG_WARN("Netlink channel failed: {}", ex.what());
+        }
+    }
+}
+
+void netlink_channel::take_submitted()
+{
+    // The stack has the newest request on top, so turn it around to send the requests in the order they came in
+    request* head = submitted_.exchange(nullptr, std::memory_order_acquire);
+    request* ordered = nullptr;
+    while (head != nullptr)
+    {
+        request* next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+    while (ordered != nullptr)
+    {
+        request* next = ordered->next;
+        backlog_.emplace_back(ordered);
+        ordered = next;
+    }
+}
+
+void netlink_channel::send_backlog()
+{
+    std::vector<const struct nlmsghdr*> batch;
+    while (!backlog_.empty() && in_flight_ < netlink::MAX_IN_FLIGHT)
+    {
+        request& req = *backlog_.front();
+        if (req.limit.expired())
+        {
+            complete(req, ETIMEDOUT);
+            backlog_.pop_front();
+            continue;
+        }
+
+        // The kernel only runs one dump at a time on a socket and rejects another with EBUSY
+        bool is_dump = (req.msg.req.hdr.nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+        if (is_dump && dump_seq_ != 0)
+        {
+            break;
+        }
+
+        uint32_t seq = claim_seq();
+        req.msg.req.hdr.nlmsg_seq = seq;
+        req.msg.req.hdr.nlmsg_pid = nl_.get_pid();
+        if (is_dump)
+        {
+            dump_seq_ = seq;
+        }
+        batch.push_back(&req.msg.req.hdr);
+        table_[seq & (TABLE_SIZE - 1)] = std::move(backlog_.front());
+        backlog_.pop_front();
+        in_flight_++;
+    }
+    if (batch.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        nl_.send_messages_async(batch);
+        batches_.fetch_add(1, std::memory_order_relaxed);
+    }
+    catch (const fnc_exception& ex)
+    {
+        // The socket is replaced before the next send, and anything still waiting for a reply on it is lost
+        LOG_DEBUG("Failed to send netlink channel batch: {}", ex.what());
+        fail_all(EIO);
+    }
+}
+
+void netlink_channel::receive_replies()
+{
+    try
+    {
+        while (nl_.receive_available([&](struct nlmsghdr* msg_ptr) {
+            request* req = table_[msg_ptr->nlmsg_seq & (TABLE_SIZE - 1)].get();
+            if (req == nullptr || req->msg.req.hdr.nlmsg_seq != msg_ptr->nlmsg_seq)
+            {
+                LOG_TRACE("Discarding stale message for pid={} seq={}", msg_ptr->nlmsg_pid, msg_ptr->nlmsg_seq);
+                return;
+            }
+
+            switch (msg_ptr->nlmsg_type)
+            {
+                case NLMSG_DONE:
+                {
+                    int error = netlink::get_done_error(msg_ptr);
+                    if (error == 0 && (req->interrupted || (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR)))
+                    {
+                        error = EINTR;
+                    }
+                    finish(msg_ptr->nlmsg_seq, error);
+                    break;
+                }
+
+                case NLMSG_ERROR:
+                {
+                    struct nlmsgerr *err = reinterpret_cast<struct nlmsgerr*>(NLMSG_DATA(msg_ptr));
+                    finish(msg_ptr->nlmsg_seq, -(err->error));
+                    break;
+                }
+
+                default:
+                    if (msg_ptr->nlmsg_flags & NLM_F_DUMP_INTR)
+                    {
+                        req->interrupted = true;
+                    }
+                    if (req->on_data && !req->abandoned && !req->callback_error)
+                    {
+                        try
+                        {
+                            req->on_data(msg_ptr);
+                        }
+                        catch (...)
+                        {
+                            // Handed to the thread waiting on the request once it completes
+                            req->callback_error = std::current_exception();
+                        }
+                    }
+                    break;
+            }
+        }))
+        { }
+    }
+    catch (const fnc_exception& ex)
+    {
+        // Replies may have been lost, so nothing that is waiting can be trusted to complete
+        LOG_DEBUG("Failed to receive netlink channel replies: {}", ex.what());
+        fail_all(dynamic_cast<const inconsistent_dump*>(&ex) ? ENOBUFS : EIO);
+    }
+}
+
+void netlink_channel::expire()
+{
+    backlog_.erase(std::remove_if(backlog_.begin(), backlog_.end(), [](const std::unique_ptr<request>& req) {
+        if (!req->limit.expired())
+        {
+            return false;
+        }
+        complete(*req, ETIMEDOUT);
+        return true;
+    }), backlog_.end());
+
+    if (in_flight_ == 0)
+    {
+        return;
+    }
+    for (auto& req : table_)
+    {
+        if (req && !req->abandoned && req->limit.expired())
+        {
+            // The slot stays taken until the kernel finishes the request, so its sequence number is not reused
+            // and a dump that is still running keeps the next one waiting
+            complete(*req, ETIMEDOUT);
+            req->abandoned = true;
+            req->on_data = nullptr;
+        }
+    }
+}
+
+std::chrono::milliseconds netlink_channel::next_timeout() const
+{
+    std::chrono::milliseconds timeout(-1);
+    auto earliest = [&](const std::unique_ptr<request>& req) {
+        if (req && !req->abandoned && !req->limit.is_never())
+        {
+            std::chrono::milliseconds remaining = req->limit.remaining();
+            timeout = timeout.count() < 0 ? remaining : std::min(timeout, remaining);
+        }
+    };
+    std::for_each(backlog_.begin(), backlog_.end(), earliest);
+    if (in_flight_ > 0)
+    {
+        std::for_each(table_.begin(), table_.end(), earliest);
+    }
+    return timeout;
+}
+
+uint32_t netlink_channel::claim_seq()
+{
+    // There are always free slots because fewer requests are in flight than the table holds
+    do
+    {
+        ++next_seq_;
+    } while (next_seq_ == 0 || table_[next_seq_ & (TABLE_SIZE - 1)]);
+    return next_seq_;
+}
+
+void netlink_channel::finish(uint32_t seq, int error)
+{
+    std::unique_ptr<request> req = std::move(table_[seq & (TABLE_SIZE - 1)]);
+    in_flight_--;
+    if (dump_seq_ == seq)
+    {
+        dump_seq_ = 0;
+    }
+    if (!req->abandoned)
+    {
+        complete(*req, error);
+    }
+}
+
+void netlink_channel::fail_all(int error)
+{
+    for (auto& req : table_)
+    {
+        if (req)
+        {
+            finish(req->msg.req.hdr.nlmsg_seq, error);
+        }
+    }
+}
+
+void netlink_channel::complete(request& req, int error)
+{
+    if (req.callback_error)
+    {
+        req.result.set_exception(req.callback_error);
+        return;
+    }
+    if (error == 0)
+    {
+        req.result.set_value();
+        return;
+    }
+    try
+    {
+        if (error == ETIMEDOUT)
+        {
+            THROW_TIMEOUT("Timeout waiting for netlink channel reply type={}", req.msg.req.hdr.nlmsg_type);
+        }
+        if (error == ECANCELED)
+        {
+            THROWEX(cancelled_exception, "Netlink channel closed before the request completed type={}", req.msg.req.hdr.nlmsg_type);
+        }
+        netlink::throw_error(error);
+    }
+    catch (...)
+    {
+        req.result.set_exception(std::current_exception());
+    }
+}
+
+} // end namespace fnc
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "netlink.hpp"
+#include "util/deadline.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Counters for the activity of a netlink_channel
+ */
+struct channel_stats
+{
+    uint64_t requests = 0;          ///< Number of requests submitted
+    uint64_t batches = 0;           ///< Number of times the I/O thread wrote a batch of requests to the socket
+    uint64_t wakeups = 0;           ///< Number of times the I/O thread woke up to do something
+};
+
+/**
+ * @brief Netlink session that any number of threads can share
+ *
+ * Threads submit requests into a lock-free queue and a single I/O thread owns the socket. Each time it wakes up
+ * it takes everything that was submitted since it last looked and writes it with one sendmsg, so under load
+ * requests from many threads share syscalls instead of each thread paying for its own. Replies are matched to
+ * their request through a table indexed by sequence number that only the I/O thread touches, so nothing on the
+ * reply path takes a lock either.
+ *
+ * Data callbacks run on the I/O thread, so they must be quick and must not wait on the channel.
+ */
+class netlink_channel
+{
+public:
+    using data_callback = std::function<void(struct nlmsghdr*)>;
+
+    constexpr static size_t TABLE_SIZE = 2 * netlink::MAX_IN_FLIGHT;  ///< Slots in the completion table, a power of two larger than the number of requests in flight
+
+    /**
+     * Constructor, which starts the I/O thread
+     */
+    netlink_channel();
+
+    /**
+     * Destructor, which stops the I/O thread. Requests that have not completed fail with a cancelled_exception
+     */
+    virtual ~netlink_channel();
+
+    netlink_channel(const netlink_channel&) = delete;
+    netlink_channel& operator=(const netlink_channel&) = delete;
+
+    /**
+     * @brief Create a request message for this channel
+     *
+     * The sequence number is assigned by the I/O thread when the request is sent. This is safe to call from any
+     * thread
+     */
+    nl_msg init_message(uint16_t nlmsg_type, uint16_t nlmsg_flags);
+
+    /**
+     * @brief Submit a request and get a future for its completion
+     *
+     * The request must ask for an ACK (NLM_F_ACK) or be a dump (NLM_F_DUMP) so that its completion can be
+     * detected. This is safe to call from any thread.
+     *
+     * @param msg       the request to send
+     * @param on_data   called on the I/O thread for each data reply to the request
+     * @param limit     when to give up on the request, which then fails with a timeout_exception
+     * @return a future that becomes ready when the request is finished, and throws if the request failed
+     */
+    std::future<void> submit(const nl_msg& msg, data_callback on_data = nullptr,
+                             const deadline& limit = deadline::after(netlink::DEFAULT_TIMEOUT));
+
+    /**
+     * @brief Send a request and wait for it to complete
+     *
+     * @see submit
+     */
+    void send_message_sync(const nl_msg& msg, data_callback on_data = nullptr,
+                           const deadline& limit = deadline::after(netlink::DEFAULT_TIMEOUT));
+
+    /**
+     * @brief Get the activity counters for this channel
+     *
+     * @return a copy of the counters
+     */
+    channel_stats get_stats() const;
+
+private:
+    struct request
+    {
+        nl_msg msg;
+        data_callback on_data;
+        deadline limit;
+        std::promise<void> result;
+        std::exception_ptr callback_error;
+        bool interrupted = false;
+        bool abandoned = false;         ///< Already completed, and only waiting for its final reply to free the slot
+        request* next = nullptr;        ///< Next request in the submission queue
+    };
+
+    netlink nl_;
+    int wake_fd_;
+    std::atomic<request*> submitted_;
+    std::atomic<bool> stopping_;
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> batches_;
+    std::atomic<uint64_t> wakeups_;
+
+    // Only touched by the I/O thread
+    std::deque<std::unique_ptr<request>> backlog_;
+    std::vector<std::unique_ptr<request>> table_;
+    size_t in_flight_;
+    uint32_t next_seq_;
+    uint32_t dump_seq_;
+
+    std::thread io_thread_;
+
+    void wake();
+    void run();
+    void take_submitted();
+    void send_backlog();
+    void receive_replies();
+    void expire();
+    std::chrono::milliseconds next_timeout() const;
+    uint32_t claim_seq();
+    void finish(uint32_t seq, int error);
+    void fail_all(int error);
+    static void complete(request& req, int error);
+};
+
+} // end namespace fnc
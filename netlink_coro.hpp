@@ -0,0 +1,284 @@
+#pragma once
+
+/**
+ * Coroutine support for netlink_async and netiface
+ *
+ * This needs C++20 coroutines, so everything here is only available when building with CXXSTD=c++20 or newer
+ * on a compiler that supports them. FNC_HAS_COROUTINES is defined when it is available.
+ */
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define FNC_HAS_COROUTINES 1
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "netlink_async.hpp"
+
+namespace fnc
+{
+
+template <typename T = void>
+class task;
+
+namespace detail
+{
+
+struct task_promise_base
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    // Tasks are lazy, they do not run until they are awaited or started
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            // Hand control straight back to whoever was awaiting this task
+            auto next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept { }
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct task_promise : task_promise_base
+{
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+    T result()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct task_promise<void> : task_promise_base
+{
+    task<void> get_return_object();
+    void return_void() { }
+    void result()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+} // end namespace detail
+
+/**
+ * @brief A lazily started coroutine that produces a T
+ *
+ * A task runs when it is co_awaited from another coroutine, or when it is passed to spawn() or sync_wait()
+ */
+template <typename T>
+class task
+{
+public:
+    using promise_type = detail::task_promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) { }
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().result(); }
+
+    /**
+     * @brief Run the task until its first suspension point
+     */
+    void start() { handle_.resume(); }
+
+    /**
+     * @brief Check if the task has finished
+     */
+    bool done() const { return handle_.done(); }
+
+    /**
+     * @brief Get the result of a finished task, rethrowing any exception it ended with
+     */
+    T result() { return handle_.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail
+{
+
+template <typename T>
+task<T> task_promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object()
+{
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { }
+    };
+};
+
+} // end namespace detail
+
+/**
+ * @brief Start a task that nobody waits for
+ *
+ * The task owns itself and is destroyed when it finishes. An exception that escapes it is logged and dropped.
+ *
+ * @param work  the task to run
+ */
+inline detail::detached_task spawn(task<void> work)
+{
+    try
+    {
+        co_await work;
+    }
+    catch (const std::exception& ex)
+    {
+        LOG_ERROR("Unhandled exception in spawned task: {}", ex.what());
+    }
+}
+
+/**
+ * @brief Run an event loop until a task finishes and return its result
+ *
+ * @param loop          the event loop that drives the task
+ * @param work          the task to run
+ * @param idle_timeout  how long to wait without any events before giving up
+ * @return the result of the task
+ */
+template <typename T>
+T sync_wait(event_loop& loop, task<T> work, std::chrono::milliseconds idle_timeout = std::chrono::seconds(2))
+{
+    work.start();
+    while (!work.done())
+    {
+        if (!loop.run_once(idle_timeout))
+        {
+            THROW_TIMEOUT("Timeout waiting for task to complete");
+        }
+    }
+    return work.result();
+}
+
+/**
+ * @brief Awaitable that submits a request on a netlink_async session and resumes when it completes
+ *
+ * Throws the same exceptions as netlink::send_message_sync when the request fails
+ */
+class netlink_request
+{
+public:
+    netlink_request(netlink_async& nl, const nl_msg& msg, netlink_async::data_callback on_data)
+        : nl_(nl),
+          msg_(msg),
+          on_data_(std::move(on_data)),
+          error_(0)
+    { }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        nl_.submit(msg_, std::move(on_data_), [this, awaiting](int error) {
+            error_ = error;
+            awaiting.resume();
+        });
+    }
+    void await_resume()
+    {
+        if (error_ != 0)
+        {
+            netlink::throw_error(error_);
+        }
+    }
+
+private:
+    netlink_async& nl_;
+    nl_msg msg_;
+    netlink_async::data_callback on_data_;
+    int error_;
+};
+
+/**
+ * @brief co_await a request on a netlink_async session
+ *
+ * @param nl        the session to send the request on
+ * @param msg       the request
+ * @param on_data   called for each data reply to the request
+ */
+inline netlink_request async_request(netlink_async& nl, const nl_msg& msg, netlink_async::data_callback on_data = nullptr)
+{
+    return netlink_request(nl, msg, std::move(on_data));
+}
+
+/**
+ * @brief Awaitable that resumes after a delay without blocking the event loop
+ */
+class loop_sleep
+{
+public:
+    loop_sleep(event_loop& loop, std::chrono::milliseconds delay) : loop_(loop), delay_(delay) { }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        loop_.call_after(delay_, [awaiting]{ awaiting.resume(); });
+    }
+    void await_resume() noexcept { }
+
+private:
+    event_loop& loop_;
+    std::chrono::milliseconds delay_;
+};
+
+} // end namespace fnc
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,615 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <string.h>
+
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "netlink_attrs.hpp"
+#include "netlink_builder.hpp"
+#include "netlink_emulator.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Get the family header of a request, or nullptr if the request is too short to have one
+ */
+template <typename T>
+static const T* get_request_header(const struct nlmsghdr* msg_ptr)
+{
+    if (msg_ptr->nlmsg_len < NLMSG_LENGTH(sizeof(T)))
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const T*>(NLMSG_DATA(msg_ptr));
+}
+
+/**
+ * @brief Spend time without giving up the CPU
+ */
+static void spin_for(std::chrono::nanoseconds duration)
+{
+    if (duration.count() <= 0)
+    {
+        return;
+    }
+    auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until)
+    { }
+}
+
+/**
+ * @brief Packs the replies to requests into datagrams, the way the kernel fills the socket receive queue
+ *
+ * Dump replies are packed together up to DUMP_DATAGRAM_LEN, everything else goes in a datagram of its own
+ */
+class netlink_emulator::reply_writer
+{
+public:
+    reply_writer(netlink_builder& builder, std::deque<std::vector<char>>& replies, emulator_stats& stats)
+        : builder_(builder),
+          replies_(replies),
+          stats_(stats),
+          request_(nullptr)
+    {
+        builder_.clear();
+    }
+
+    ~reply_writer()
+    {
+        flush();
+    }
+
+    /**
+     * @brief Set the request that the next replies answer
+     */
+    void set_request(const struct nlmsghdr* request)
+    {
+        request_ = request;
+    }
+
+    /**
+     * @brief Start a reply to the current request
+     */
+    netlink_builder& begin(uint16_t nlmsg_type, uint16_t nlmsg_flags)
+    {
+        if (builder_.size() >= DUMP_DATAGRAM_LEN)
+        {
+            flush();
+        }
+        builder_.begin(nlmsg_type, nlmsg_flags, request_->nlmsg_seq, request_->nlmsg_pid);
+        stats_.replies++;
+        return builder_;
+    }
+
+    /**
+     * @brief Finish a dump of the current request, with an errno value if the dump failed
+     */
+    void done(int error = 0)
+    {
+        begin(NLMSG_DONE, NLM_F_MULTI);
+        *builder_.get_header<int>() = -error;
+        flush();
+    }
+
+    /**
+     * @brief Answer the current request with an error, or an ACK if error is 0
+     */
+    void ack(int error)
+    {
+        flush();
+        begin(NLMSG_ERROR, 0);
+        struct nlmsgerr* err = builder_.get_header<struct nlmsgerr>();
+        err->error = -error;
+        err->msg = *request_;
+        flush();
+    }
+
+    /**
+     * @brief Queue whatever has been written as a datagram
+     */
+    void flush()
+    {
+        if (builder_.count() == 0)
+        {
+            return;
+        }
+        const char* data = reinterpret_cast<const char*>(builder_.get_message(0));
+        replies_.emplace_back(data, data + builder_.size());
+        builder_.clear();
+    }
+
+private:
+    netlink_builder& builder_;
+    std::deque<std::vector<char>>& replies_;
+    emulator_stats& stats_;
+    const struct nlmsghdr* request_;
+};
+
+/**
+ * @brief The end of a netlink session that talks to the emulator, in place of its socket
+ */
+class netlink_emulator::connection : public netlink_transport
+{
+public:
+    connection(netlink_emulator& emulator)
+        : emulator_(emulator),
+          builder_(DUMP_DATAGRAM_LEN + 4096)
+    { }
+
+    void send(const void* data, size_t len) override
+    {
+        size_t requests = 0;
+        std::chrono::nanoseconds latency;
+        {
+            std::lock_guard<std::mutex> lock(emulator_.mutex_);
+            emulator_.stats_.sends++;
+            reply_writer writer(builder_, replies_, emulator_.stats_);
+            int remaining = len;
+            for (const struct nlmsghdr* msg_ptr = static_cast<const struct nlmsghdr*>(data); NLMSG_OK(msg_ptr, remaining); msg_ptr = NLMSG_NEXT(msg_ptr, remaining))
+            {
+                writer.set_request(msg_ptr);
+                emulator_.handle(msg_ptr, writer);
+                requests++;
+            }
+            latency = emulator_.per_send_ + emulator_.per_request_ * requests;
+        }
+        spin_for(latency);
+    }
+    using netlink_transport::send;
+
+    bool receive(std::vector<char>& datagram) override
+    {
+        if (replies_.empty())
+        {
+            return false;
+        }
+        datagram = std::move(replies_.front());
+        replies_.pop_front();
+        return true;
+    }
+
+private:
+    netlink_emulator& emulator_;
+    netlink_builder builder_;
+    std::deque<std::vector<char>> replies_;
+};
+
+bool netlink_emulator::address_entry::operator<(const address_entry& other) const
+{
+    if (family != other.family)
+    {
+        return family < other.family;
+    }
+    return bytes < other.bytes;
+}
+
+netlink_emulator::netlink_emulator()
+    : next_index_(1),
+      per_request_(0),
+      per_send_(0)
+{
+    iface_idx_t lo = add_link("lo", 65536);
+    add_address(lo, ip_address("127.0.0.1", 8));
+    add_address(lo, ip_address("::1", 128));
+}
+
+iface_idx_t netlink_emulator::add_link(const std::string& name, mtu_t mtu, const mac_address& mac)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (names_.count(name) > 0)
+    {
+        THROWEX(illegal_argument, "Emulated link already exists name={}", name);
+    }
+
+    link_entry& link = links_[next_index_];
+    link.index = next_index_++;
+    link.name = name;
+    link.mtu = mtu;
+    mac.get_bytes(link.mac.data());
+    if (link.index > 1 && std::all_of(link.mac.begin(), link.mac.end(), [](uint8_t octet) { return octet == 0; }))
+    {
+        // A locally administered address made from the index, so every link has a different one
+        link.mac = { 0x02, 0x00, static_cast<uint8_t>(link.index >> 24), static_cast<uint8_t>(link.index >> 16),
+                     static_cast<uint8_t>(link.index >> 8), static_cast<uint8_t>(link.index) };
+    }
+    names_[name] = link.index;
+    return link.index;
+}
+
+void netlink_emulator::del_link(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = names_.find(name);
+    if (it == names_.end())
+    {
+        THROWEX(illegal_argument, "Emulated link does not exist name={}", name);
+    }
+    links_.erase(it->second);
+    names_.erase(it);
+}
+
+void netlink_emulator::add_address(iface_idx_t index, ip_address address)
+{
+    address_entry entry;
+    entry.bytes.fill(0);
+    entry.scope = address.get_scope();
+    if (address.is_v4())
+    {
+        struct sockaddr_in addr = address.to_sockaddr_in();
+        entry.family = AF_INET;
+        entry.prefix = address.get_prefix() < 0 ? 32 : address.get_prefix();
+        memcpy(entry.bytes.data(), &addr.sin_addr, sizeof(addr.sin_addr));
+    }
+    else
+    {
+        struct sockaddr_in6 addr = address.to_sockaddr_in6();
+        entry.family = AF_INET6;
+        entry.prefix = address.get_prefix() < 0 ? 128 : address.get_prefix();
+        memcpy(entry.bytes.data(), &addr.sin6_addr, sizeof(addr.sin6_addr));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = links_.find(index);
+    if (it == links_.end())
+    {
+        THROWEX(illegal_argument, "Emulated link does not exist index={}", index);
+    }
+    it->second.addresses.insert(entry);
+}
+
+void netlink_emulator::set_latency(std::chrono::nanoseconds per_request, std::chrono::nanoseconds per_send)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    per_request_ = per_request;
+    per_send_ = per_send;
+}
+
+std::unique_ptr<netlink_transport> netlink_emulator::connect()
+{
+    return std::make_unique<connection>(*this);
+}
+
+emulator_stats netlink_emulator::get_stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void netlink_emulator::handle(const struct nlmsghdr* msg_ptr, reply_writer& writer)
+{
+    stats_.requests++;
+    if (msg_ptr->nlmsg_type < NLMSG_MIN_TYPE || (msg_ptr->nlmsg_flags & NLM_F_REQUEST) == 0)
+    {
+        // Control messages such as NLMSG_NOOP are only acknowledged, which makes them barriers
+        if ((msg_ptr->nlmsg_flags & NLM_F_ACK) != 0)
+        {
+            writer.ack(0);
+        }
+        return;
+    }
+    bool is_dump = (msg_ptr->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP;
+    int error = 0;
+    switch (msg_ptr->nlmsg_type)
+    {
+        case RTM_GETLINK:
+            if (is_dump)
+            {
+                dump_links(writer);
+                writer.done();
+                return;
+            }
+            error = get_link(msg_ptr, writer);
+            break;
+
+        case RTM_NEWLINK:
+            error = set_link(msg_ptr);
+            break;
+
+        case RTM_GETADDR:
+            if (is_dump)
+            {
+                writer.done(dump_addresses(msg_ptr, writer));
+                return;
+            }
+            error = EOPNOTSUPP;
+            break;
+
+        case RTM_NEWADDR:
+            error = new_address(msg_ptr, writer);
+            break;
+
+        case RTM_DELADDR:
+            error = del_address(msg_ptr, writer);
+            break;
+
+        default:
+            LOG_DEBUG("Emulated kernel does not handle message type={}", msg_ptr->nlmsg_type);
+            error = EOPNOTSUPP;
+            break;
+    }
+    if (error != 0 || (msg_ptr->nlmsg_flags & NLM_F_ACK))
+    {
+        writer.ack(error);
+    }
+}
+
+netlink_emulator::link_entry* netlink_emulator::find_link(const struct nlmsghdr* msg_ptr)
+{
+    // Like the kernel, the index wins over the name if the request has both
+    const struct ifinfomsg* ifinfo = get_request_header<struct ifinfomsg>(msg_ptr);
+    if (ifinfo == nullptr)
+    {
+        return nullptr;
+    }
+    if (ifinfo->ifi_index > 0)
+    {
+        auto it = links_.find(ifinfo->ifi_index);
+        return it == links_.end() ? nullptr : &it->second;
+    }
+
+    attr_table<IFLA_MAX> attrs(IFLA_RTA(ifinfo), msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifinfo)));
+    auto name = names_.find(std::string(attrs.get_string(IFLA_IFNAME)));
+    if (name == names_.end())
+    {
+        return nullptr;
+    }
+    return &links_.at(name->second);
+}
+
+int netlink_emulator::get_link(const struct nlmsghdr* msg_ptr, reply_writer& writer)
+{
+    link_entry* link = find_link(msg_ptr);
+    if (link == nullptr)
+    {
+        return ENODEV;
+    }
+    write_link(writer, *link, 0);
+    writer.flush();
+    return 0;
+}
+
+void netlink_emulator::dump_links(reply_writer& writer)
+{
+    for (const auto& entry : links_)
+    {
+        write_link(writer, entry.second, NLM_F_MULTI);
+    }
+}
+
+int netlink_emulator::set_link(const struct nlmsghdr* msg_ptr)
+{
+    link_entry* link = find_link(msg_ptr);
+    if (link == nullptr)
+    {
+        return ENODEV;
+    }
+
+    const struct ifinfomsg* ifinfo = get_request_header<struct ifinfomsg>(msg_ptr);
+    attr_table<IFLA_MAX> attrs(IFLA_RTA(ifinfo), msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifinfo)));
+    mtu_t mtu;
+    if (attrs.get(IFLA_MTU, mtu))
+    {
+        if (mtu < 68)
+        {
+            return EINVAL;
+        }
+        link->mtu = mtu;
+    }
+    attr_bytes mac = attrs.get_bytes(IFLA_ADDRESS);
+    if (!mac.empty())
+    {
+        if (mac.len != link->mac.size())
+        {
+            return EINVAL;
+        }
+        memcpy(link->mac.data(), mac.data, mac.len);
+    }
+    return 0;
+}
+
+int netlink_emulator::dump_addresses(const struct nlmsghdr* msg_ptr, reply_writer& writer)
+{
+    // Filtered by family, and by link like a strictly checked dump
+    const struct ifaddrmsg* ifaddr = get_request_header<struct ifaddrmsg>(msg_ptr);
+    int family = ifaddr ? ifaddr->ifa_family : AF_UNSPEC;
+    iface_idx_t index = ifaddr ? ifaddr->ifa_index : 0;
+
+    auto write_link_addresses = [&](const link_entry& link) {
+        for (const auto& address : link.addresses)
+        {
+            if (family == AF_UNSPEC || family == address.family)
+            {
+                write_address(writer, link, address, RTM_NEWADDR, NLM_F_MULTI);
+            }
+        }
+    };
+    if (index > 0)
+    {
+        auto it = links_.find(index);
+        if (it == links_.end())
+        {
+            return ENODEV;
+        }
+        write_link_addresses(it->second);
+        return 0;
+    }
+    for (const auto& entry : links_)
+    {
+        write_link_addresses(entry.second);
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the address of an RTM_NEWADDR/RTM_DELADDR request
+ *
+ * @return 0, or an errno value if the request does not have a usable address
+ */
+static int get_request_address(const struct nlmsghdr* msg_ptr, const struct ifaddrmsg* ifaddr, std::array<uint8_t, 16>& bytes)
+{
+    attr_table<IFA_MAX> attrs(IFA_RTA(ifaddr), msg_ptr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifaddr)));
+    attr_bytes address = attrs.has(IFA_LOCAL) ? attrs.get_bytes(IFA_LOCAL) : attrs.get_bytes(IFA_ADDRESS);
+    size_t len;
+    if (ifaddr->ifa_family == AF_INET)
+    {
+        len = sizeof(struct in_addr);
+    }
+    else if (ifaddr->ifa_family == AF_INET6)
+    {
+        len = sizeof(struct in6_addr);
+    }
+    else
+    {
+        return EAFNOSUPPORT;
+    }
+    if (address.len != len)
+    {
+        return EINVAL;
+    }
+    bytes.fill(0);
+    memcpy(bytes.data(), address.data, len);
+    return 0;
+}
+
+int netlink_emulator::new_address(const struct nlmsghdr* msg_ptr, reply_writer& writer)
+{
+    const struct ifaddrmsg* ifaddr = get_request_header<struct ifaddrmsg>(msg_ptr);
+    if (ifaddr == nullptr)
+    {
+        return EINVAL;
+    }
+    auto link = links_.find(ifaddr->ifa_index);
+    if (link == links_.end())
+    {
+        return ENODEV;
+    }
+
+    address_entry entry;
+    entry.family = ifaddr->ifa_family;
+    entry.prefix = ifaddr->ifa_prefixlen;
+    entry.scope = ifaddr->ifa_scope;
+    int error = get_request_address(msg_ptr, ifaddr, entry.bytes);
+    if (error != 0)
+    {
+        return error;
+    }
+    if (entry.prefix > (entry.family == AF_INET ? 32 : 128))
+    {
+        return EINVAL;
+    }
+
+    auto existing = link->second.addresses.find(entry);
+    if (existing != link->second.addresses.end())
+    {
+        if (msg_ptr->nlmsg_flags & NLM_F_EXCL)
+        {
+            return EEXIST;
+        }
+        link->second.addresses.erase(existing);
+    }
+    link->second.addresses.insert(entry);
+    echo_address(msg_ptr, writer, link->second, entry, RTM_NEWADDR);
+    return 0;
+}
+
+int netlink_emulator::del_address(const struct nlmsghdr* msg_ptr, reply_writer& writer)
+{
+    const struct ifaddrmsg* ifaddr = get_request_header<struct ifaddrmsg>(msg_ptr);
+    if (ifaddr == nullptr)
+    {
+        return EINVAL;
+    }
+    auto link = links_.find(ifaddr->ifa_index);
+    if (link == links_.end())
+    {
+        return ENODEV;
+    }
+
+    address_entry entry;
+    entry.family = ifaddr->ifa_family;
+    int error = get_request_address(msg_ptr, ifaddr, entry.bytes);
+    if (error != 0)
+    {
+        return error;
+    }
+
+    // IPv4 addresses are matched by address alone, IPv6 addresses by address and prefix
+    auto existing = link->second.addresses.find(entry);
+    if (existing == link->second.addresses.end() ||
+        (entry.family == AF_INET6 && existing->prefix != ifaddr->ifa_prefixlen))
+    {
+        return EADDRNOTAVAIL;
+    }
+    address_entry removed = *existing;
+    link->second.addresses.erase(existing);
+    echo_address(msg_ptr, writer, link->second, removed, RTM_DELADDR);
+    return 0;
+}
+
+void netlink_emulator::echo_address(const struct nlmsghdr* msg_ptr,
+                                    reply_writer& writer,
+                                    const link_entry& link,
+                                    const address_entry& address,
+                                    uint16_t nlmsg_type)
+{
+    // The kernel echoes IPv4 address changes before the ACK. IPv6 ones are announced by duplicate address
+    // detection, which does not know who asked, so they are not
+    if ((msg_ptr->nlmsg_flags & NLM_F_ECHO) == 0 || address.family != AF_INET)
+    {
+        return;
+    }
+    write_address(writer, link, address, nlmsg_type, 0);
+    writer.flush();
+}
+
+void netlink_emulator::write_link(reply_writer& writer, const link_entry& link, uint16_t flags)
+{
+    netlink_builder& msg = writer.begin(RTM_NEWLINK, flags);
+    struct ifinfomsg* ifinfo = msg.get_header<struct ifinfomsg>();
+    ifinfo->ifi_family = AF_UNSPEC;
+    ifinfo->ifi_index = link.index;
+    if (link.name == "lo")
+    {
+        ifinfo->ifi_type = ARPHRD_LOOPBACK;
+        ifinfo->ifi_flags = IFF_UP | IFF_RUNNING | IFF_LOOPBACK;
+    }
+    else
+    {
+        ifinfo->ifi_type = ARPHRD_ETHER;
+        ifinfo->ifi_flags = IFF_UP | IFF_RUNNING | IFF_BROADCAST | IFF_MULTICAST;
+    }
+    msg.add_string(IFLA_IFNAME, link.name);
+    msg.add(IFLA_MTU, link.mtu);
+    msg.add(IFLA_TXQLEN, static_cast<uint32_t>(1000));
+    // The loopback driver does not report carrier, so the kernel leaves it unknown
+    msg.add(IFLA_OPERSTATE, link.name == "lo" ? oper_state::unknown : oper_state::up);
+    msg.add_attr(IFLA_ADDRESS, link.mac.data(), link.mac.size());
+}
+
+void netlink_emulator::write_address(reply_writer& writer,
+                                     const link_entry& link,
+                                     const address_entry& address,
+                                     uint16_t nlmsg_type,
+                                     uint16_t flags)
+{
+    netlink_builder& msg = writer.begin(nlmsg_type, flags);
+    struct ifaddrmsg* ifaddr = msg.get_header<struct ifaddrmsg>();
+    ifaddr->ifa_family = address.family;
+    ifaddr->ifa_prefixlen = address.prefix;
+    ifaddr->ifa_flags = IFA_F_PERMANENT;
+    ifaddr->ifa_scope = address.scope;
+    ifaddr->ifa_index = link.index;
+    size_t len = address.family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+    msg.add_attr(IFA_ADDRESS, address.bytes.data(), len);
+    if (address.family == AF_INET)
+    {
+        msg.add_attr(IFA_LOCAL, address.bytes.data(), len);
+    }
+}
+
+} // end namespace fnc
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ip_address.hpp"
+#include "mac_address.hpp"
+#include "netiface.hpp"
+#include "netlink_transport.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Counters for the requests a netlink_emulator has answered
+ */
+struct emulator_stats
+{
+    uint64_t sends = 0;             ///< Number of datagrams sent to the emulator, the syscalls a real socket would make
+    uint64_t requests = 0;          ///< Number of requests answered
+    uint64_t replies = 0;           ///< Number of reply messages sent back, including ACKs and NLMSG_DONE
+};
+
+/**
+ * @brief In-process stand-in for the rtnetlink side of the kernel
+ *
+ * Keeps a table of links (name, index, MTU, MAC) and their addresses, and answers the requests netiface makes -
+ * RTM_GETLINK, RTM_NEWLINK, RTM_GETADDR, RTM_NEWADDR and RTM_DELADDR - with the same messages, errors and multi-part
+ * dumps the kernel would. Address dumps are filtered like a kernel with NETLINK_GET_STRICT_CHK, and IPv4 address
+ * changes are echoed to requests with NLM_F_ECHO. Sessions connect to it with
+ * netlink::use_transport(emulator.connect()), so everything above the socket runs unchanged without root, without
+ * touching the host, and at any scale.
+ *
+ * A configurable latency is spent on every request and every send, so pipelining and batching can be measured
+ * against a known cost per syscall and per message instead of whatever the machine running the benchmark does.
+ * The emulator is safe to share between threads, and must outlive the sessions connected to it.
+ *
+ * @example
+ * @code
+ * netlink_emulator kernel;
+ * kernel.add_link("eth0", 9000);
+ * netlink nl;
+ * nl.use_transport(kernel.connect());
+ * netiface eth0("eth0", &nl);
+ * eth0.set_ip_address(ip_address("10.0.0.1", 24));
+ * @endcode
+ */
+class netlink_emulator
+{
+public:
+    constexpr static size_t DUMP_DATAGRAM_LEN = 16384;     ///< Most bytes of dump replies packed into one datagram
+
+    /**
+     * Constructor, with only the loopback interface
+     */
+    netlink_emulator();
+
+    netlink_emulator(const netlink_emulator&) = delete;
+    netlink_emulator& operator=(const netlink_emulator&) = delete;
+
+    /**
+     * @brief Create a link
+     *
+     * Throws an illegal_argument if a link with the same name exists
+     *
+     * @param name  the name of the link
+     * @param mtu   the MTU of the link
+     * @param mac   the MAC address of the link
+     * @return the index of the new link
+     */
+    iface_idx_t add_link(const std::string& name, mtu_t mtu = 1500, const mac_address& mac = mac_address());
+
+    /**
+     * @brief Delete a link and its addresses
+     *
+     * Like the kernel, the index of the link is not given out again. Throws an illegal_argument if there is no
+     * link with the name
+     *
+     * @param name  the name of the link
+     */
+    void del_link(const std::string& name);
+
+    /**
+     * @brief Add an address to a link
+     *
+     * Throws an illegal_argument if there is no link with that index
+     *
+     * @param index     the link to add the address to
+     * @param address   the address, with its prefix
+     */
+    void add_address(iface_idx_t index, ip_address address);
+
+    /**
+     * @brief Set how long the emulated kernel takes
+     *
+     * The time is spent busy waiting, which is steadier than sleeping at microsecond scale
+     *
+     * @param per_request   spent on every request
+     * @param per_send      spent on every datagram that is sent, like the cost of a syscall
+     */
+    void set_latency(std::chrono::nanoseconds per_request, std::chrono::nanoseconds per_send = std::chrono::nanoseconds(0));
+
+    /**
+     * @brief Open a connection to the emulator for a netlink session
+     *
+     * @return the transport to pass to netlink::use_transport
+     */
+    std::unique_ptr<netlink_transport> connect();
+
+    /**
+     * @brief Get the counters for the requests this emulator has answered
+     *
+     * @return a copy of the counters
+     */
+    emulator_stats get_stats() const;
+
+private:
+    class connection;
+    class reply_writer;
+
+    struct address_entry
+    {
+        uint8_t family;
+        uint8_t prefix;
+        uint8_t scope;
+        std::array<uint8_t, 16> bytes;
+
+        bool operator<(const address_entry& other) const;
+    };
+
+    struct link_entry
+    {
+        iface_idx_t index;
+        std::string name;
+        mtu_t mtu;
+        std::array<uint8_t, 6> mac;
+        std::set<address_entry> addresses;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<iface_idx_t, link_entry> links_;
+    std::unordered_map<std::string, iface_idx_t> names_;
+    iface_idx_t next_index_;
+    std::chrono::nanoseconds per_request_;
+    std::chrono::nanoseconds per_send_;
+    emulator_stats stats_;
+
+    void handle(const struct nlmsghdr* msg_ptr, reply_writer& writer);
+    link_entry* find_link(const struct nlmsghdr* msg_ptr);
+    int get_link(const struct nlmsghdr* msg_ptr, reply_writer& writer);
+    void dump_links(reply_writer& writer);
+    int set_link(const struct nlmsghdr* msg_ptr);
+    int dump_addresses(const struct nlmsghdr* msg_ptr, reply_writer& writer);
+    int new_address(const struct nlmsghdr* msg_ptr, reply_writer& writer);
+    int del_address(const struct nlmsghdr* msg_ptr, reply_writer& writer);
+    static void echo_address(const struct nlmsghdr* msg_ptr, reply_writer& writer, const link_entry& link, const address_entry& address, uint16_t nlmsg_type);
+    static void write_link(reply_writer& writer, const link_entry& link, uint16_t flags);
+    static void write_address(reply_writer& writer, const link_entry& link, const address_entry& address, uint16_t nlmsg_type, uint16_t flags);
+};
+
+} // end namespace fnc
@@ -0,0 +1,164 @@
+#include <linux/netlink.h>
+#include <string.h>
+
+#include "exceptions.hpp"
+#include "logging.hpp"
+#include "netlink_record.hpp"
+
+namespace fnc
+{
+
+static const char RECORDING_MAGIC[4] = { 'F', 'N', 'C', 'R' };
+static const uint32_t RECORDING_VERSION = 1;
+
+/**
+ * @brief The header in front of every datagram in a recording
+ */
+struct record_header
+{
+    uint8_t direction;
+    uint8_t reserved[3];
+    uint32_t len;
+    uint64_t timestamp_ns;
+};
+
+std::vector<netlink_record> read_recording(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        THROWEX(fnc_exception, "Failed to open netlink recording path={}", path);
+    }
+
+    char magic[sizeof(RECORDING_MAGIC)];
+    uint32_t version = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!in || memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 || version != RECORDING_VERSION)
+    {
+        THROWEX(fnc_exception, "Not a netlink recording path={}", path);
+    }
+
+    std::vector<netlink_record> records;
+    record_header header;
+    while (in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        netlink_record record;
+        record.direction = static_cast<record_direction>(header.direction);
+        record.timestamp = std::chrono::nanoseconds(header.timestamp_ns);
+        record.data.resize(header.len);
+        if (!in.read(record.data.data(), header.len))
+        {
+            THROWEX(fnc_exception, "Netlink recording is truncated after {} datagrams path={}", records.size(), path);
+        }
+        records.push_back(std::move(record));
+    }
+    return records;
+}
+
+netlink_recorder::netlink_recorder(const std::string& path)
+    : out_(path, std::ios::binary | std::ios::trunc),
+      path_(path),
+      start_(std::chrono::steady_clock::now())
+{
+    if (!out_)
+    {
+        THROWEX(fnc_exception, "Failed to create netlink recording path={}", path);
+    }
+    out_.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    out_.write(reinterpret_cast<const char*>(&RECORDING_VERSION), sizeof(RECORDING_VERSION));
+}
+
+void netlink_recorder::record(record_direction direction, const void* data, size_t len)
+{
+    record_header header;
+    memset(&header, 0, sizeof(header));
+    header.direction = static_cast<uint8_t>(direction);
+    header.len = len;
+    header.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+    out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out_.write(static_cast<const char*>(data), len);
+    if (!out_)
+    {
+        THROWEX(fnc_exception, "Failed to write netlink recording path={}", path_);
+    }
+}
+
+void netlink_recorder::record(record_direction direction, const struct msghdr* msg)
+{
+    std::vector<char> datagram = gather_datagram(msg);
+    record(direction, datagram.data(), datagram.size());
+}
+
+netlink_replay::netlink_replay(std::shared_ptr<const std::vector<netlink_record>> records, uint32_t pid)
+    : records_(std::move(records)),
+      pid_(pid),
+      next_(0)
+{ }
+
+void netlink_replay::send(const void* data, size_t len)
+{
+    const std::vector<netlink_record>& records = *records_;
+
+    // Anything received before this request was recorded is delivered first, such as notifications
+    while (next_ < records.size() && records[next_].direction == record_direction::received)
+    {
+        replies_.push_back(next_++);
+    }
+    const struct nlmsghdr* live = static_cast<const struct nlmsghdr*>(data);
+    if (next_ == records.size())
+    {
+        THROW_NETEX("Netlink replay has no more requests to match type={} seq={}", live->nlmsg_type, live->nlmsg_seq);
+    }
+    const netlink_record& recorded = records[next_++];
+
+    // The requests must be the same ones that were recorded, apart from their sequence numbers
+    int live_len = len;
+    int recorded_len = recorded.data.size();
+    const struct nlmsghdr* expected = reinterpret_cast<const struct nlmsghdr*>(recorded.data.data());
+    while (NLMSG_OK(live, live_len))
+    {
+        if (!NLMSG_OK(expected, recorded_len) || expected->nlmsg_type != live->nlmsg_type || expected->nlmsg_flags != live->nlmsg_flags)
+        {
+            THROW_NETEX("Netlink replay diverged from the recording at datagram={} type={} flags={:#x}",
+                        next_ - 1, live->nlmsg_type, live->nlmsg_flags);
+        }
+        seq_map_[expected->nlmsg_seq] = live->nlmsg_seq;
+        live = NLMSG_NEXT(live, live_len);
+        expected = NLMSG_NEXT(expected, recorded_len);
+    }
+
+    while (next_ < records.size() && records[next_].direction == record_direction::received)
+    {
+        replies_.push_back(next_++);
+    }
+}
+
+bool netlink_replay::receive(std::vector<char>& datagram)
+{
+    if (replies_.empty())
+    {
+        return false;
+    }
+    datagram = (*records_)[replies_.front()].data;
+    replies_.pop_front();
+
+    int len = datagram.size();
+    for (struct nlmsghdr* msg_ptr = reinterpret_cast<struct nlmsghdr*>(datagram.data()); NLMSG_OK(msg_ptr, len); msg_ptr = NLMSG_NEXT(msg_ptr, len))
+    {
+        auto it = seq_map_.find(msg_ptr->nlmsg_seq);
+        if (it != seq_map_.end())
+        {
+            msg_ptr->nlmsg_seq = it->second;
+        }
+        msg_ptr->nlmsg_pid = pid_;
+    }
+    return true;
+}
+
+size_t netlink_replay::remaining() const
+{
+    return records_->size() - next_ + replies_.size();
+}
+
+} // end namespace fnc
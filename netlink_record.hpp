@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+#include "netlink_transport.hpp"
+
+namespace fnc
+{
+
+/**
+ * @brief Which way a recorded datagram went
+ */
+enum class record_direction : uint8_t
+{
+    sent     = 1,
+    received = 2
+};
+
+/**
+ * @brief A single datagram of netlink traffic
+ */
+struct netlink_record
+{
+    record_direction direction;
+    std::chrono::nanoseconds timestamp;     ///< Time since the recording started
+    std::vector<char> data;                 ///< The whole datagram, which may hold several messages
+};
+
+/**
+ * @brief Read every datagram from a file written by a netlink_recorder
+ *
+ * Throws an fnc_exception if the file cannot be read or is not a recording
+ *
+ * @param path  the file to read
+ * @return the datagrams in the order they were recorded
+ */
+std::vector<netlink_record> read_recording(const std::string& path);
+
+/**
+ * @brief Writes netlink traffic to a file, see netlink::record_to
+ *
+ * The file is a short header followed by one record per datagram - direction, length and timestamp, then the
+ * datagram exactly as it went over the socket. Nothing is decoded, so recording costs little more than the copy.
+ */
+class netlink_recorder
+{
+public:
+    /**
+     * Constructor
+     *
+     * Throws an fnc_exception if the file cannot be created
+     *
+     * @param path  the file to write, replacing it if it exists
+     */
+    netlink_recorder(const std::string& path);
+
+    /**
+     * @brief Append a datagram to the recording
+     */
+    void record(record_direction direction, const void* data, size_t len);
+
+    /**
+     * @brief Append a datagram made of several buffers to the recording, such as a batch of requests
+     */
+    void record(record_direction direction, const struct msghdr* msg);
+
+private:
+    std::ofstream out_;
+    std::string path_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Plays back a recording in place of the kernel, see netlink::replay
+ *
+ * Each request that is sent is checked against the next request in the recording, and the replies that were
+ * recorded after it are queued to be received. Sequence numbers in the replies are rewritten to match the
+ * requests being replayed, so the same client code gets the same answers without a socket or any privileges.
+ * Client code that sends something the recording does not have fails with a network_exception.
+ */
+class netlink_replay : public netlink_transport
+{
+public:
+    /**
+     * Constructor
+     *
+     * @param records   the recording to play back, which can be shared by any number of replays
+     * @param pid       the port ID to put in the replies
+     */
+    netlink_replay(std::shared_ptr<const std::vector<netlink_record>> records, uint32_t pid);
+
+    /**
+     * @brief Match a request against the recording and queue the replies that were recorded for it
+     */
+    void send(const void* data, size_t len) override;
+    using netlink_transport::send;
+
+    /**
+     * @brief Take the next reply datagram, with its sequence numbers rewritten
+     */
+    bool receive(std::vector<char>& datagram) override;
+
+    /**
+     * @brief Get the number of datagrams that have not been played back yet, including queued replies
+     */
+    size_t remaining() const;
+
+private:
+    std::shared_ptr<const std::vector<netlink_record>> records_;
+    uint32_t pid_;
+    size_t next_;
+    std::deque<size_t> replies_;
+    std::unordered_map<uint32_t, uint32_t> seq_map_;
+};
+
+} // end namespace fnc
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <vector>
+
+namespace fnc
+{
+
+/**
+ * @brief Copy the buffers of a msghdr into one datagram
+ */
+inline std::vector<char> gather_datagram(const struct msghdr* msg)
+{
+    std::vector<char> datagram;
+    for (size_t idx = 0; idx < msg->msg_iovlen; ++idx)
+    {
+        const char* base = static_cast<const char*>(msg->msg_iov[idx].iov_base);
+        datagram.insert(datagram.end(), base, base + msg->msg_iov[idx].iov_len);
+    }
+    return datagram;
+}
+
+/**
+ * @brief Something other than a kernel socket that a netlink session can talk to, see netlink::use_transport
+ *
+ * A transport takes whole request datagrams and hands back whole reply datagrams, exactly as they would go over the
+ * socket, so everything above it in the session - sequence matching, dumps, retries and the parsing in netiface -
+ * runs the same as it does against the kernel. Replies have to be ready by the time send returns, the same as the
+ * kernel does for rtnetlink requests, because the session never waits on a transport.
+ */
+class netlink_transport
+{
+public:
+    virtual ~netlink_transport() = default;
+
+    /**
+     * @brief Take a datagram holding one or more requests
+     */
+    virtual void send(const void* data, size_t len) = 0;
+
+    /**
+     * @brief Take a datagram made of several buffers, such as a batch of requests
+     */
+    virtual void send(const struct msghdr* msg)
+    {
+        std::vector<char> datagram = gather_datagram(msg);
+        send(datagram.data(), datagram.size());
+    }
+
+    /**
+     * @brief Take the next reply datagram
+     *
+     * @param datagram  set to the reply
+     * @return false if there are no replies queued
+     */
+    virtual bool receive(std::vector<char>& datagram) = 0;
+};
+
+} // end namespace fnc
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <string>
+
+#include "catch.hpp"
+#include "address_cache.hpp"
+#include "exceptions.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+#include "util/container_util.hpp"
+#include "util/retry_wait.hpp"
+#include "util/scope_exit.hpp"
+#include "util/test.hpp"
+
+using namespace fnc;
+
+TEST_CASE("address_cache:Lookup", "[address_cache]")
+{
+    address_cache cache;
+
+    // Loopback always has the loopback addresses
+    netlink nl;
+    netiface lo("lo", &nl);
+    REQUIRE(cache.contains(lo.get_index(), ip_address("127.0.0.1", 8)));
+    REQUIRE(cache.get(lo.get_index()) == lo.get_ip_addresses());
+    REQUIRE(cache.get(lo.get_index(), ip_family_type::v4) == lo.get_ip_addresses(ip_family_type::v4));
+    REQUIRE(cache.get(lo.get_index(), ip_family_type::v6) == lo.get_ip_addresses(ip_family_type::v6));
+    REQUIRE(cache.get(0x7FFFFFFF).empty());
+
+    cache.resync();
+    REQUIRE(cache.get(lo.get_index()) == lo.get_ip_addresses());
+    REQUIRE(cache.get_stats().resyncs == 1);
+
+    // Getters and the check for an address that is already there answer from the cache without a request
+    lo.use_address_cache(&cache);
+    uint64_t sent = nl.get_stats().messages_sent;
+    for (int i = 0; i < 1000; ++i)
+    {
+        REQUIRE(contains(lo.get_ip_addresses(), ip_address("127.0.0.1", 8)));
+    }
+    lo.set_ip_addresses({ ip_address("127.0.0.1", 8) });
+    REQUIRE(nl.get_stats().messages_sent == sent);
+}
+
+TEST_CASE("address_cache:Notifications", "[address_cache]")
+{
+    address_cache cache;
+    netlink nl;
+    netiface lo("lo", &nl);
+    lo.use_address_cache(&cache);
+    ip_address address("127.0.0.2", 8);
+    auto restore = make_scope_exit([&]{ shell_exec("ip addr del 127.0.0.2/8 dev lo 2>/dev/null || true"); });
+
+    // Changes made elsewhere come to the cache without asking for them
+    uint64_t updates = cache.get_stats().updates;
+    shell_exec("ip addr add 127.0.0.2/8 dev lo");
+    WaitFor(std::chrono::milliseconds(2000), "Address cache was not updated", [&]{
+        return cache.contains(lo.get_index(), address);
+    });
+    shell_exec("ip addr del 127.0.0.2/8 dev lo");
+    WaitFor(std::chrono::milliseconds(2000), "Address cache was not updated", [&]{
+        return !cache.contains(lo.get_index(), address);
+    });
+    REQUIRE(cache.get_stats().updates >= updates + 2);
+
+    // netiface waits for its own changes to reach the cache
+    lo.set_ip_address(address);
+    REQUIRE(contains(lo.get_ip_addresses(), address));
+    lo.del_ip_address(address);
+    REQUIRE(!contains(lo.get_ip_addresses(), address));
+    REQUIRE(cache.get_stats().resyncs == 0);
+}
+
+TEST_CASE("address_cache:Lookup speed", "[.][benchmark]")
+{
+    netlink nl;
+    netiface iface("lo", &nl);
+
+    BENCHMARK("get_ip_addresses from the kernel")
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            iface.get_ip_addresses();
+        }
+    }
+
+    iface.use_address_cache(&address_cache::instance());
+    BENCHMARK("get_ip_addresses from the address cache")
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            iface.get_ip_addresses();
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#include <linux/genetlink.h>
+#include <set>
+#include <string>
+
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "genl_family.hpp"
+#include "netlink.hpp"
+#include "netlink_attrs.hpp"
+
+using namespace fnc;
+
+TEST_CASE("genl_family:Cache", "[genl_family]")
+{
+    genl_family_cache cache;
+
+    // The controller is always there, and tells us about itself
+    std::shared_ptr<const genl_family> nlctrl = cache.get(genl_family_cache::CTRL_NAME);
+    REQUIRE(nlctrl->id == GENL_ID_CTRL);
+    REQUIRE(nlctrl->name == genl_family_cache::CTRL_NAME);
+    REQUIRE(nlctrl->has_op(CTRL_CMD_GETFAMILY));
+    REQUIRE(nlctrl->get_group_id("notify") > 0);
+    REQUIRE_THROWS_AS(nlctrl->get_group_id("no-such-group"), network_exception);
+
+    // Later lookups do not ask the kernel
+    genl_cache_stats before = cache.get_stats();
+    REQUIRE(cache.get(genl_family_cache::CTRL_NAME) == nlctrl);
+    REQUIRE(cache.get_family_id(genl_family_cache::CTRL_NAME) == GENL_ID_CTRL);
+    genl_cache_stats after = cache.get_stats();
+    REQUIRE(after.hits == before.hits + 2);
+    REQUIRE(after.misses == before.misses);
+
+    // Until the family is dropped
+    cache.invalidate(genl_family_cache::CTRL_NAME);
+    REQUIRE(cache.get(genl_family_cache::CTRL_NAME) != nlctrl);
+    REQUIRE(cache.get_stats().misses == after.misses + 1);
+
+    // Families that do not exist are not cached
+    REQUIRE_THROWS_AS(cache.get("fnc-no-such-family"), network_exception);
+    REQUIRE_THROWS_AS(cache.get("fnc-no-such-family"), network_exception);
+    REQUIRE(cache.get_stats().misses == after.misses + 3);
+}
+
+TEST_CASE("genl_family:Generic session", "[genl_family]")
+{
+    // Every family the kernel has can be listed through the controller, and each one resolves to the same ID
+    netlink& nl = netlink::thread_generic_session();
+    REQUIRE(nl.get_protocol() == NETLINK_GENERIC);
+    uint16_t ctrl_id = genl_family_cache::instance().get_family_id(genl_family_cache::CTRL_NAME);
+    nl_msg message = nl.init_genl_message(ctrl_id, CTRL_CMD_GETFAMILY, 1, NLM_F_REQUEST | NLM_F_DUMP);
+
+    std::set<std::pair<std::string, uint16_t>> families;
+    nl.send_dump_sync(message, [&]{ families.clear(); }, [&](struct nlmsghdr* msg_ptr) {
+        const char* first = static_cast<const char*>(NLMSG_DATA(msg_ptr)) + GENL_HDRLEN;
+        attr_table<CTRL_ATTR_MAX> attrs(reinterpret_cast<const struct rtattr*>(first), msg_ptr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+        uint16_t id = 0;
+        attrs.get(CTRL_ATTR_FAMILY_ID, id);
+        families.emplace(std::string(attrs.get_string(CTRL_ATTR_FAMILY_NAME)), id);
+    });
+    REQUIRE(families.count(std::make_pair(std::string(genl_family_cache::CTRL_NAME), static_cast<uint16_t>(GENL_ID_CTRL))) == 1);
+    for (const auto& family : families)
+    {
+        REQUIRE(genl_family_cache::instance().get_family_id(family.first) == family.second);
+    }
+}
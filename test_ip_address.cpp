@@ -85,6 +85,22 @@ TEST_CASE("ip_address:ctor", "[ip_address]")
     REQUIRE(addr6a.get_scope() == addr6.get_scope());
 }
 
+TEST_CASE("ip_address:from bytes", "[ip_address]")
+{
+    uint8_t v4[] = { 1, 2, 3, 4 };
+    REQUIRE(ip_address(AF_INET, v4) == ip_address("1.2.3.4"));
+    REQUIRE(ip_address(AF_INET, v4, 24) == ip_address("1.2.3.4", 24));
+
+    uint8_t v6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+    v6[15] = 1;
+    REQUIRE(ip_address(AF_INET6, v6, 96) == ip_address("2001:db8::1", 96));
+
+    uint8_t loopback[] = { 127, 0, 0, 1 };
+    REQUIRE(ip_address(AF_INET, loopback).get_scope() == ip_address_scope::host);
+
+    REQUIRE_THROWS_AS(ip_address(AF_UNIX, v4), illegal_argument);
+}
+
 TEST_CASE("ip_address:equality", "[ip_address]")
 {
     ip_address a("1.2.3.4");
@@ -0,0 +1,85 @@
+#include <chrono>
+#include <string>
+
+#include "spdlog/fmt/fmt.h"
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "link_cache.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+#include "util/retry_wait.hpp"
+#include "util/scope_exit.hpp"
+#include "util/test.hpp"
+
+using namespace fnc;
+
+TEST_CASE("link_cache:Lookup", "[link_cache]")
+{
+    link_cache cache;
+
+    // Loopback is always there, and always the first link of a namespace
+    std::optional<link_info> lo = cache.get("lo");
+    REQUIRE(lo);
+    REQUIRE(lo->index == 1);
+    REQUIRE((lo->flags & IFF_LOOPBACK) != 0);
+    REQUIRE(cache.get(1)->name == "lo");
+    REQUIRE(!cache.get("fnc-nolink"));
+    REQUIRE(!cache.get(0x7FFFFFFF));
+    REQUIRE(cache.get_all().size() == netiface::get_iface_names().size());
+
+    cache.resync();
+    REQUIRE(cache.get("lo")->mtu == lo->mtu);
+    REQUIRE(cache.get_stats().resyncs == 1);
+
+    // Getters answer from the cache without a request
+    netlink nl;
+    netiface iface("lo", &nl);
+    iface.use_link_cache(&cache);
+    uint64_t sent = nl.get_stats().messages_sent;
+    for (int i = 0; i < 1000; ++i)
+    {
+        REQUIRE(iface.get_mtu() == lo->mtu);
+    }
+    REQUIRE(nl.get_stats().messages_sent == sent);
+    REQUIRE(iface.get_link_info().mtu == lo->mtu);
+    REQUIRE(nl.get_stats().messages_sent == sent + 1);
+}
+
+TEST_CASE("link_cache:Notifications", "[link_cache]")
+{
+    link_cache cache;
+    uint32_t txqueuelen = cache.get("lo")->txqueuelen;
+    auto restore = make_scope_exit([&]{ shell_exec(fmt::format("ip link set dev lo txqueuelen {}", txqueuelen)); });
+
+    // The change comes to the cache without asking for it
+    uint64_t updates = cache.get_stats().updates;
+    shell_exec(fmt::format("ip link set dev lo txqueuelen {}", txqueuelen + 1));
+    WaitFor(std::chrono::milliseconds(2000), "Link cache was not updated", [&]{
+        return cache.get("lo")->txqueuelen == txqueuelen + 1;
+    });
+    REQUIRE(cache.get_stats().updates > updates);
+    REQUIRE(cache.get_stats().resyncs == 0);
+}
+
+TEST_CASE("link_cache:Lookup speed", "[.][benchmark]")
+{
+    netlink nl;
+    netiface iface("lo", &nl);
+
+    BENCHMARK("get_mtu from the kernel")
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            iface.get_mtu();
+        }
+    }
+
+    iface.use_link_cache(&link_cache::instance());
+    BENCHMARK("get_mtu from the link cache")
+    {
+        for (int i = 0; i < 10000; ++i)
+        {
+            iface.get_mtu();
+        }
+    }
+}
@@ -1,11 +1,16 @@
+#include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string/predicate.hpp>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "spdlog/fmt/fmt.h"
 #include "catch.hpp"
+#include "exceptions.hpp"
 #include "netiface.hpp"
 #include "logging.hpp"
+#include "util/scope_exit.hpp"
 #include "util/test.hpp"
 
 using namespace fnc;
@@ -96,6 +101,11 @@ TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Get iface properties", "[netif
     REQUIRE(nic.get_mtu() == iface_mtu);
 }
 
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Missing iface", "[netiface]")
+{
+    REQUIRE_THROWS_AS(netiface("doesnotexist0"), network_exception);
+}
+
 TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Add IP address", "[netiface]")
 {
     netiface nic(iface_name);
@@ -116,6 +126,49 @@ TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Set MTU", "[netiface]")
     REQUIRE(shell_exec(fmt::format("cat /sys/class/net/{}/mtu | tr -d '\n'", iface_name)) == "7777");
 }
 
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Confirm by notification", "[netiface]")
+{
+    netlink nl;
+    netiface nic(iface_name, &nl);
+
+    // The notification for the change confirms it, so the link is not read back
+    uint64_t sent = nl.get_stats().messages_sent;
+    nic.set_mtu(7777);
+    REQUIRE(nl.get_stats().messages_sent == sent + 1);
+
+    // Setting the MTU the link already has is not announced, so the link is read back once instead
+    nic.set_mtu(7777);
+    REQUIRE(nl.get_stats().messages_sent == sent + 3);
+    REQUIRE(nic.get_mtu() == 7777);
+
+    ip_address ip6("2001:0db8:0:f101::2", 64);
+    auto start = std::chrono::steady_clock::now();
+    nic.set_ip_address(ip6);
+    nic.del_ip_address(ip6);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50));
+    REQUIRE(!contains(nic.get_ip_addresses(), ip6));
+
+    // The notification is already queued when the request returns, so confirming takes no time at all
+    nic.set_confirm_timeout(std::chrono::milliseconds(0));
+    nic.set_mtu(iface_mtu);
+    REQUIRE(nic.get_mtu() == iface_mtu);
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Timeout", "[netiface]")
+{
+    netlink nl;
+    netiface nic(iface_name, &nl);
+
+    // The timeout covers the whole operation, so one with no time at all fails before anything is changed
+    nic.set_timeout(std::chrono::milliseconds(0));
+    REQUIRE_THROWS_AS(nic.set_mtu(7777), timeout_exception);
+    REQUIRE(shell_exec(fmt::format("cat /sys/class/net/{}/mtu | tr -d '\n'", iface_name)) == std::to_string(iface_mtu));
+
+    nic.set_timeout(std::chrono::seconds(5));
+    nic.set_mtu(7777);
+    REQUIRE(nic.get_mtu() == 7777);
+}
+
 TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Del IP address", "[netiface]")
 {
     netiface nic(iface_name);
@@ -128,3 +181,264 @@ TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Del IP address", "[netiface]")
     REQUIRE(shell_exec(fmt::format("ip addr show {} | grep {} || echo -n false", iface_name, ipv6_address)) == "false");
     nic.del_ip_address(ip_address(ipv6_address));
 }
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Session reuse", "[.][benchmark]")
+{
+    const int iterations = 100;
+
+    // A new session for every operation, the way each call used to open its own socket
+    uint64_t fresh_syscalls = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        netlink nl;
+        netiface(iface_name, &nl).get_mtu();
+        fresh_syscalls += nl.get_stats().syscalls + 1; // +1 for the close in the destructor
+    }
+
+    // One session shared by every operation
+    netlink shared;
+    uint64_t start_syscalls = shared.get_stats().syscalls;
+    for (int i = 0; i < iterations; ++i)
+    {
+        netiface(iface_name, &shared).get_mtu();
+    }
+    uint64_t shared_syscalls = shared.get_stats().syscalls - start_syscalls;
+
+    WARN(fmt::format("syscalls per operation: fresh session={} shared session={}",
+                     static_cast<double>(fresh_syscalls) / iterations,
+                     static_cast<double>(shared_syscalls) / iterations));
+    REQUIRE(shared_syscalls < fresh_syscalls);
+    REQUIRE(shared.get_stats().sockets_opened == 1);
+
+    BENCHMARK("fresh session")
+    {
+        netlink nl;
+        netiface(iface_name, &nl).get_mtu();
+    }
+    BENCHMARK("shared session")
+    {
+        netiface(iface_name, &shared).get_mtu();
+    }
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Add IP addresses", "[netiface]")
+{
+    netiface nic(iface_name);
+
+    std::vector<ip_address> addresses;
+    for (int i = 1; i <= 200; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.{}.{}.1", i / 100, i % 100), 24);
+    }
+    addresses.emplace_back(ipv4_address, ipv4_prefix); // already present
+    nic.set_ip_addresses(addresses);
+
+    auto ips = nic.get_ip_addresses(ip_family_type::v4);
+    REQUIRE(ips.size() == 201);
+    for (const auto& address : addresses)
+    {
+        REQUIRE(contains(ips, address));
+    }
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Large address dump", "[.][benchmark]")
+{
+    netlink nl;
+    netiface nic(iface_name, &nl);
+
+    std::vector<ip_address> addresses;
+    for (int i = 0; i < 2000; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.{}.{}.1", i / 250, i % 250), 24);
+    }
+    nic.set_ip_addresses(addresses);
+
+    netlink_stats before = nl.get_stats();
+    REQUIRE(nic.get_ip_addresses(ip_family_type::v4).size() == addresses.size() + 1);
+    netlink_stats after = nl.get_stats();
+
+    uint64_t recv_syscalls = after.recv_syscalls - before.recv_syscalls;
+    WARN(fmt::format("receive syscalls={} datagrams/syscall={} messages/syscall={} bytes/syscall={}",
+                     recv_syscalls,
+                     static_cast<double>(after.datagrams_received - before.datagrams_received) / recv_syscalls,
+                     static_cast<double>(after.messages_received - before.messages_received) / recv_syscalls,
+                     static_cast<double>(after.bytes_received - before.bytes_received) / recv_syscalls));
+
+    BENCHMARK("address dump")
+    {
+        nic.get_ip_addresses();
+    }
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Filtered dumps", "[.][benchmark]")
+{
+    const int iterations = 100;
+    std::string busy_name = "test1";
+
+    // Lots of addresses on some other interface, which a query for this one should not have to copy
+    shell_exec(fmt::format("ip link del {} &>/dev/null", busy_name));
+    shell_exec(fmt::format("ip link add {} type dummy", busy_name));
+    auto cleanup = make_scope_exit([&]{ shell_exec(fmt::format("ip link del {}", busy_name)); });
+    netlink nl;
+    netiface busy(busy_name, &nl);
+    std::vector<ip_address> addresses;
+    for (int i = 0; i < 2000; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.{}.{}.1", i / 250, i % 250), 24);
+    }
+    busy.set_ip_addresses(addresses);
+
+    netiface nic(iface_name, &nl);
+    netlink_stats before = nl.get_stats();
+    for (int i = 0; i < iterations; ++i)
+    {
+        REQUIRE(nic.get_ip_addresses(ip_family_type::v4).size() == 1);
+    }
+    netlink_stats after = nl.get_stats();
+
+    uint64_t bytes_per_query = (after.bytes_received - before.bytes_received) / iterations;
+    WARN(fmt::format("strict check={} bytes received per query={}", nl.has_strict_check(), bytes_per_query));
+    if (nl.has_strict_check())
+    {
+        // A single link and address, against about 160KB for an unfiltered dump
+        REQUIRE(bytes_per_query < 16384);
+    }
+
+    BENCHMARK("address query")
+    {
+        nic.get_ip_addresses(ip_family_type::v4);
+    }
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Dumps during churn", "[.][benchmark]")
+{
+    const int iterations = 200;
+    std::string busy_name = "test1";
+
+    shell_exec(fmt::format("ip link del {} &>/dev/null", busy_name));
+    shell_exec(fmt::format("ip link add {} type dummy", busy_name));
+    auto cleanup = make_scope_exit([&]{ shell_exec(fmt::format("ip link del {}", busy_name)); });
+
+    netlink nl;
+    netiface nic(iface_name, &nl);
+    std::vector<ip_address> addresses;
+    for (int i = 0; i < 500; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.{}.{}.1", i / 250, i % 250), 24);
+    }
+    nic.set_ip_addresses(addresses);
+
+    // Keep changing addresses on another interface, which makes the kernel mark address dumps as interrupted
+    std::atomic_bool stop(false);
+    std::thread churn([&]{
+        netlink churn_nl;
+        netiface busy(busy_name, &churn_nl);
+        ip_address address("10.99.0.1", 24);
+        while (!stop)
+        {
+            busy.set_ip_address(address);
+            busy.del_ip_address(address);
+        }
+    });
+    auto stop_churn = make_scope_exit([&]{ stop = true; churn.join(); });
+
+    unsigned most_attempts = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+        REQUIRE(nic.get_ip_addresses(ip_family_type::v4).size() == addresses.size() + 1);
+        most_attempts = std::max(most_attempts, nl.get_last_dump().attempts);
+    }
+
+    const netlink_stats& stats = nl.get_stats();
+    WARN(fmt::format("dumps={} interrupted={} retries={} overflows={} most attempts for one dump={}",
+                     stats.dumps, stats.dumps_interrupted, stats.dump_retries, stats.rx_overflows, most_attempts));
+}
+
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:io_uring transport", "[.][benchmark]")
+{
+    const int iterations = 100;
+
+    netlink ring;
+    if (!ring.use_io_uring())
+    {
+        WARN("io_uring is not available, only the socket syscalls can be measured");
+    }
+    netlink plain;
+    netiface ring_nic(iface_name, &ring);
+    netiface plain_nic(iface_name, &plain);
+
+    // Add and remove an address over and over, the way interfaces are configured during a container start/stop storm
+    ip_address address("10.99.0.1", 24);
+    auto churn = [&](netiface& nic) {
+        nic.set_ip_address(address);
+        nic.del_ip_address(address);
+        nic.get_mtu();
+    };
+
+    uint64_t start_syscalls = ring.get_stats().syscalls;
+    for (int i = 0; i < iterations; ++i)
+    {
+        churn(ring_nic);
+    }
+    uint64_t ring_syscalls = ring.get_stats().syscalls - start_syscalls;
+
+    start_syscalls = plain.get_stats().syscalls;
+    for (int i = 0; i < iterations; ++i)
+    {
+        churn(plain_nic);
+    }
+    uint64_t plain_syscalls = plain.get_stats().syscalls - start_syscalls;
+
+    WARN(fmt::format("syscalls per iteration: socket={} io_uring={}",
+                     static_cast<double>(plain_syscalls) / iterations,
+                     static_cast<double>(ring_syscalls) / iterations));
+    REQUIRE(ring_nic.get_mtu() == iface_mtu);
+    REQUIRE(ring_nic.get_ip_addresses().size() == 2);
+    if (ring.is_using_io_uring())
+    {
+        REQUIRE(ring_syscalls < plain_syscalls);
+    }
+
+    BENCHMARK("socket syscalls")
+    {
+        churn(plain_nic);
+    }
+    BENCHMARK("io_uring")
+    {
+        churn(ring_nic);
+    }
+}
+
+#ifdef FNC_HAS_COROUTINES
+TEST_CASE_METHOD(SingleDummyNicFixture, "netiface:Coroutines", "[netiface]")
+{
+    event_loop loop;
+    netlink_async nl(loop);
+    netiface nic(iface_name);
+
+    REQUIRE(sync_wait(loop, nic.co_get_index(nl)) == iface_index);
+    REQUIRE(sync_wait(loop, nic.co_get_mtu(nl)) == iface_mtu);
+    REQUIRE(boost::iequals(sync_wait(loop, nic.co_get_mac_address(nl)).to_string(), iface_mac));
+
+    // Several independent operations interleaved on one thread
+    int finished = 0;
+    auto configure = [&](ip_address address) -> task<void> {
+        co_await nic.co_set_ip_address(nl, address);
+        finished++;
+    };
+    for (int i = 1; i <= 10; ++i)
+    {
+        spawn(configure(ip_address(fmt::format("10.0.0.{}", i), 24)));
+    }
+    sync_wait(loop, nic.co_set_mtu(nl, 7777));
+    while (finished < 10)
+    {
+        REQUIRE(loop.run_once(std::chrono::seconds(2)));
+    }
+    REQUIRE(nic.get_mtu() == 7777);
+    REQUIRE(sync_wait(loop, nic.co_get_ip_addresses(nl, ip_family_type::v4)).size() == 11);
+
+    sync_wait(loop, nic.co_del_ip_address(nl, ip_address(ipv4_address)));
+    REQUIRE(!contains(nic.get_ip_addresses(), ip_address(ipv4_address, ipv4_prefix)));
+}
+#endif
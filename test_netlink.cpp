@@ -0,0 +1,129 @@
+#include <chrono>
+#include <thread>
+
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+#include "util/scope_exit.hpp"
+
+using namespace fnc;
+
+TEST_CASE("netlink:Deadline", "[netlink]")
+{
+    netlink nl;
+    nl.set_timeout(std::chrono::milliseconds(50));
+
+    // Nothing was asked for, so nothing arrives and the wait gives up after the session timeout
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS_AS(nl.handle_response_async(), timeout_exception);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(elapsed >= std::chrono::milliseconds(50));
+    REQUIRE(elapsed < std::chrono::seconds(1));
+
+    // An expired deadline fails without waiting, and the session recovers afterwards
+    {
+        netlink::deadline_scope scope(nl, std::chrono::milliseconds(0));
+        REQUIRE_THROWS_AS(netiface::get_iface_names(&nl), timeout_exception);
+    }
+    REQUIRE(!netiface::get_iface_names(&nl).empty());
+}
+
+TEST_CASE("netlink:Nested deadlines", "[netlink]")
+{
+    netlink nl;
+    nl.set_timeout(std::chrono::seconds(30));
+    REQUIRE(nl.get_deadline().remaining() > std::chrono::seconds(20));
+    {
+        netlink::deadline_scope outer(nl, std::chrono::milliseconds(100));
+        {
+            // An inner scope cannot give an operation more time than the caller has
+            netlink::deadline_scope inner(nl, std::chrono::seconds(10));
+            REQUIRE(nl.get_deadline().remaining() <= std::chrono::milliseconds(100));
+        }
+        {
+            netlink::deadline_scope inner(nl, std::chrono::milliseconds(-1));
+            REQUIRE(!nl.get_deadline().is_never());
+        }
+    }
+    {
+        netlink::deadline_scope unlimited(nl, std::chrono::milliseconds(-1));
+        REQUIRE(nl.get_deadline().is_never());
+    }
+    REQUIRE(nl.get_deadline().remaining() > std::chrono::seconds(20));
+}
+
+TEST_CASE("netlink:Bulk acks", "[netlink]")
+{
+    netlink nl;
+    nl.set_bulk_acks(true);
+
+    // The kernel only answers the lookup that fails, and the barrier after them stands in for the ACK of the other
+    std::vector<nl_msg> messages;
+    for (const char* name : { "lo", "fnc-nolink" })
+    {
+        messages.push_back(nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK));
+        messages.back().add_string(IFLA_IFNAME, name);
+    }
+    size_t replies = 0;
+    std::vector<int> results = nl.send_messages(messages, [&](size_t idx, struct nlmsghdr*) {
+        REQUIRE(idx == 0);
+        replies++;
+    });
+    REQUIRE(results == std::vector<int>{ 0, ENODEV });
+    REQUIRE(replies == 1);
+    REQUIRE(nl.get_stats().barriers == 1);
+
+    // Single requests still wait for their own ACK
+    REQUIRE(!netiface::get_iface_names(&nl).empty());
+    REQUIRE(nl.get_stats().stale_messages == 0);
+}
+
+TEST_CASE("netlink:Cancel", "[netlink]")
+{
+    for (bool ring : { false, true })
+    {
+        netlink nl;
+        if (ring && !nl.use_io_uring())
+        {
+            WARN("io_uring is not available, only the socket syscalls can be cancelled");
+            continue;
+        }
+        nl.set_timeout(std::chrono::seconds(10));
+
+        auto start = std::chrono::steady_clock::now();
+        std::thread canceller([&]{
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            nl.cancel();
+        });
+        REQUIRE_THROWS_AS(nl.handle_response_async(), cancelled_exception);
+        canceller.join();
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        // The cancel is used up, so the next operation runs normally
+        REQUIRE(!netiface::get_iface_names(&nl).empty());
+    }
+}
+
+TEST_CASE("netlink:Receive until", "[netlink]")
+{
+    netlink monitor;
+    monitor.add_membership(RTNLGRP_LINK);
+
+    // Nothing changed, so the wait gives up at the deadline without an error
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(!monitor.receive_until([](struct nlmsghdr*) {}, deadline::after(std::chrono::milliseconds(50))));
+    REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    // A change is announced before the request that made it returns, so it is read without waiting
+    netlink nl;
+    netiface lo("lo", &nl);
+    mtu_t mtu = lo.get_mtu();
+    auto restore = make_scope_exit([&]{ lo.set_mtu(mtu); });
+    lo.set_mtu(mtu - 1);
+    bool announced = false;
+    REQUIRE(monitor.receive_until([&](struct nlmsghdr* msg_ptr) {
+        announced = announced || msg_ptr->nlmsg_type == RTM_NEWLINK;
+    }, deadline::after(std::chrono::milliseconds(0))));
+    REQUIRE(announced);
+}
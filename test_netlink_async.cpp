@@ -0,0 +1,136 @@
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "event_loop.hpp"
+#include "exceptions.hpp"
+#include "netlink_async.hpp"
+
+using namespace fnc;
+
+TEST_CASE("netlink:Many sessions", "[netlink]")
+{
+    const int threads = 8;
+    const int sessions_per_thread = 50;
+
+    // Every thread opens its sessions at the same time, and they all stay open until the end so the port IDs must
+    // all differ. A port is free to be reused once its socket is closed
+    std::mutex lock;
+    std::set<uint32_t> pids;
+    std::vector<std::unique_ptr<netlink>> all_sessions;
+    int failures = 0;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]{
+            try
+            {
+                std::vector<std::unique_ptr<netlink>> sessions;
+                for (int j = 0; j < sessions_per_thread; ++j)
+                {
+                    sessions.push_back(std::make_unique<netlink>());
+                }
+                for (auto& session : sessions)
+                {
+                    nl_msg message = session->init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+                    session->send_message_sync(message, [](struct nlmsghdr*){});
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                for (auto& session : sessions)
+                {
+                    pids.insert(session->get_pid());
+                    all_sessions.push_back(std::move(session));
+                }
+            }
+            catch (const std::exception&)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                failures++;
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(pids.size() == threads * sessions_per_thread);
+}
+
+TEST_CASE("event_loop:post", "[event_loop]")
+{
+    event_loop loop;
+    int calls = 0;
+    loop.post([&]{ calls++; });
+    loop.post([&]{ calls++; loop.stop(); });
+    loop.run();
+    REQUIRE(calls == 2);
+}
+
+TEST_CASE("netlink_async:Concurrent requests", "[netlink_async]")
+{
+    event_loop loop;
+    std::vector<std::unique_ptr<netlink_async>> sessions;
+    for (int i = 0; i < 4; ++i)
+    {
+        sessions.push_back(std::make_unique<netlink_async>(loop));
+    }
+
+    // Many link dumps in flight at once across all of the sessions
+    const int requests = 400;
+    int completed = 0;
+    int links = 0;
+    for (int i = 0; i < requests; ++i)
+    {
+        netlink_async& session = *sessions[i % sessions.size()];
+        nl_msg message = session.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+        session.submit(message, [&](struct nlmsghdr* msg_ptr) {
+            if (msg_ptr->nlmsg_type == RTM_NEWLINK)
+            {
+                links++;
+            }
+        }, [&](int error) {
+            REQUIRE(error == 0);
+            completed++;
+        });
+    }
+    REQUIRE(sessions[0]->get_outstanding() == requests / sessions.size());
+
+    while (completed < requests)
+    {
+        REQUIRE(loop.run_once(std::chrono::seconds(2)));
+    }
+    REQUIRE(links >= requests);
+    for (auto& session : sessions)
+    {
+        REQUIRE(session->get_outstanding() == 0);
+    }
+}
+
+TEST_CASE("netlink_async:Future", "[netlink_async]")
+{
+    event_loop loop;
+    netlink_async session(loop);
+
+    nl_msg message = session.init_message(RTM_GETADDR, NLM_F_REQUEST | NLM_F_DUMP);
+    int addresses = 0;
+    auto result = session.submit(message, [&](struct nlmsghdr* msg_ptr) {
+        if (msg_ptr->nlmsg_type == RTM_NEWADDR)
+        {
+            addresses++;
+        }
+    });
+    loop.wait(result);
+    REQUIRE(addresses > 0);
+
+    // Errors are delivered through the future
+    message = session.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK);
+    message.req.ifaddr.ifa_family = AF_INET;
+    message.req.ifaddr.ifa_index = 0x7FFFFFFF;
+    auto failed = session.submit(message);
+    REQUIRE_THROWS(loop.wait(failed));
+}
@@ -0,0 +1,70 @@
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <string>
+
+#include "catch.hpp"
+#include "netlink_attrs.hpp"
+#include "netlink_builder.hpp"
+
+using namespace fnc;
+
+TEST_CASE("netlink_builder:Batch", "[netlink_builder]")
+{
+    netlink_builder builder(64);
+    for (uint32_t seq = 1; seq <= 100; ++seq)
+    {
+        builder.begin(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_ACK, seq, 42);
+        builder.get_header<struct ifinfomsg>()->ifi_index = seq;
+        builder.add<uint32_t>(IFLA_MTU, 1000 + seq);
+        builder.add_string(IFLA_IFNAME, "dummy" + std::to_string(seq));
+    }
+    REQUIRE(builder.count() == 100);
+
+    // Every message survives the buffer growing underneath it, and they are packed back to back
+    for (uint32_t seq = 1; seq <= 100; ++seq)
+    {
+        const struct nlmsghdr* hdr = builder.get_message(seq - 1);
+        REQUIRE(hdr->nlmsg_seq == seq);
+        REQUIRE(hdr->nlmsg_pid == 42);
+        if (seq < 100)
+        {
+            REQUIRE(reinterpret_cast<const char*>(hdr) + NLMSG_ALIGN(hdr->nlmsg_len) == reinterpret_cast<const char*>(builder.get_message(seq)));
+        }
+
+        struct ifinfomsg* ifinfo = reinterpret_cast<struct ifinfomsg*>(NLMSG_DATA(hdr));
+        REQUIRE(ifinfo->ifi_index == static_cast<int>(seq));
+        attr_table<IFLA_MAX> attrs(IFLA_RTA(ifinfo), hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifinfo)));
+        uint32_t mtu = 0;
+        REQUIRE(attrs.get(IFLA_MTU, mtu));
+        REQUIRE(mtu == 1000 + seq);
+        REQUIRE(attrs.get_string(IFLA_IFNAME) == "dummy" + std::to_string(seq));
+    }
+
+    builder.clear();
+    REQUIRE(builder.count() == 0);
+}
+
+TEST_CASE("netlink_builder:Nested attributes", "[netlink_builder]")
+{
+    netlink_builder builder;
+    builder.begin(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK, 1, 0);
+    builder.add_string(IFLA_IFNAME, "test0");
+    size_t linkinfo = builder.begin_nested(IFLA_LINKINFO);
+    builder.add_string(IFLA_INFO_KIND, "dummy");
+    builder.end_nested(linkinfo);
+    builder.add<uint32_t>(IFLA_MTU, 9000);
+
+    const struct nlmsghdr* hdr = builder.get_message(0);
+    struct ifinfomsg* ifinfo = reinterpret_cast<struct ifinfomsg*>(NLMSG_DATA(hdr));
+    attr_table<IFLA_MAX> attrs(IFLA_RTA(ifinfo), hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*ifinfo)));
+    REQUIRE(attrs.get_string(IFLA_IFNAME) == "test0");
+
+    uint32_t mtu = 0;
+    REQUIRE(attrs.get(IFLA_MTU, mtu));
+    REQUIRE(mtu == 9000);
+
+    attr_bytes nested = attrs.get_bytes(IFLA_LINKINFO);
+    REQUIRE(!nested.empty());
+    attr_table<IFLA_INFO_MAX> info(reinterpret_cast<const struct rtattr*>(nested.data), nested.len);
+    REQUIRE(info.get_string(IFLA_INFO_KIND) == "dummy");
+}
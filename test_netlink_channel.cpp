@@ -0,0 +1,177 @@
+#include <atomic>
+#include <linux/if_link.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "spdlog/fmt/fmt.h"
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "netlink_channel.hpp"
+
+using namespace fnc;
+
+/**
+ * @brief Look up the index of the loopback interface by name
+ */
+template <typename Session, typename Send>
+static int get_loopback_index(Session& session, const Send& send)
+{
+    int index = 0;
+    nl_msg message = session.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK);
+    message.add_string(IFLA_IFNAME, "lo");
+    send(message, [&](struct nlmsghdr* msg_ptr) {
+        if (msg_ptr->nlmsg_type == RTM_NEWLINK)
+        {
+            index = reinterpret_cast<struct ifinfomsg*>(NLMSG_DATA(msg_ptr))->ifi_index;
+        }
+    });
+    return index;
+}
+
+TEST_CASE("netlink_channel:Concurrent requests", "[netlink_channel]")
+{
+    netlink_channel channel;
+    auto send = [&](const nl_msg& message, std::function<void(struct nlmsghdr*)> on_data) {
+        channel.send_message_sync(message, on_data);
+    };
+
+    // Every thread shares the one socket, and each gets back the replies to its own requests
+    const int threads = 8;
+    const int requests_per_thread = 200;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&]{
+            for (int j = 0; j < requests_per_thread; ++j)
+            {
+                try
+                {
+                    if (get_loopback_index(channel, send) != 1)
+                    {
+                        failures++;
+                    }
+                }
+                catch (const std::exception&)
+                {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    REQUIRE(failures == 0);
+
+    channel_stats stats = channel.get_stats();
+    REQUIRE(stats.requests == threads * requests_per_thread);
+    REQUIRE(stats.batches <= stats.requests);
+
+    // Dumps are run one at a time even when they are all submitted together
+    std::vector<std::future<void>> dumps;
+    std::atomic<int> links(0);
+    for (int i = 0; i < 50; ++i)
+    {
+        nl_msg message = channel.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+        dumps.push_back(channel.submit(message, [&](struct nlmsghdr* msg_ptr) {
+            if (msg_ptr->nlmsg_type == RTM_NEWLINK)
+            {
+                links++;
+            }
+        }));
+    }
+    for (auto& dump : dumps)
+    {
+        dump.get();
+    }
+    REQUIRE(links >= 50);
+}
+
+TEST_CASE("netlink_channel:Errors", "[netlink_channel]")
+{
+    netlink_channel channel;
+
+    // Errors from the kernel are thrown to the thread that is waiting
+    nl_msg message = channel.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK);
+    message.req.ifaddr.ifa_family = AF_INET;
+    message.req.ifaddr.ifa_index = 0x7FFFFFFF;
+    REQUIRE_THROWS_AS(channel.send_message_sync(message), network_exception);
+
+    // So are errors from its own callback
+    message = channel.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    REQUIRE_THROWS_AS(channel.send_message_sync(message, [](struct nlmsghdr*) { throw std::runtime_error("callback failed"); }),
+                      std::runtime_error);
+
+    // A request that has run out of time is never sent
+    message = channel.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    REQUIRE_THROWS_AS(channel.send_message_sync(message, nullptr, deadline::after(std::chrono::milliseconds(0))), timeout_exception);
+
+    // Requests that cannot be told apart when they complete are refused
+    message = channel.init_message(RTM_GETLINK, NLM_F_REQUEST);
+    REQUIRE_THROWS_AS(channel.submit(message), illegal_argument);
+
+    // And the channel keeps working afterwards
+    message = channel.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+    REQUIRE_NOTHROW(channel.send_message_sync(message));
+}
+
+TEST_CASE("netlink_channel:Shared channel", "[.][benchmark]")
+{
+    const int threads = 8;
+    const int requests_per_thread = 1000;
+    auto run_threads = [&](const std::function<void()>& work) {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(work);
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    };
+
+    netlink_channel channel;
+    run_threads([&]{
+        auto send = [&](const nl_msg& message, std::function<void(struct nlmsghdr*)> on_data) {
+            channel.send_message_sync(message, on_data);
+        };
+        for (int j = 0; j < requests_per_thread; ++j)
+        {
+            get_loopback_index(channel, send);
+        }
+    });
+    channel_stats stats = channel.get_stats();
+    WARN(fmt::format("threads={} requests={} batches={} requests/batch={}",
+                     threads, stats.requests, stats.batches, static_cast<double>(stats.requests) / stats.batches));
+
+    BENCHMARK("socket per thread")
+    {
+        run_threads([&]{
+            netlink& nl = netlink::thread_session();
+            auto send = [&](const nl_msg& message, std::function<void(struct nlmsghdr*)> on_data) {
+                nl.send_message_sync(message, on_data);
+            };
+            for (int j = 0; j < requests_per_thread; ++j)
+            {
+                get_loopback_index(nl, send);
+            }
+        });
+    }
+
+    BENCHMARK("shared channel")
+    {
+        run_threads([&]{
+            auto send = [&](const nl_msg& message, std::function<void(struct nlmsghdr*)> on_data) {
+                channel.send_message_sync(message, on_data);
+            };
+            for (int j = 0; j < requests_per_thread; ++j)
+            {
+                get_loopback_index(channel, send);
+            }
+        });
+    }
+}
@@ -0,0 +1,252 @@
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "spdlog/fmt/fmt.h"
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+#include "netlink_emulator.hpp"
+
+using namespace fnc;
+
+TEST_CASE("netlink_emulator:netiface", "[netlink_emulator]")
+{
+    netlink_emulator kernel;
+    iface_idx_t index = kernel.add_link("eth0", 1500, mac_address("52:54:00:12:34:56"));
+    netlink nl;
+    nl.use_transport(kernel.connect());
+    REQUIRE(nl.is_using_transport());
+
+    REQUIRE(netiface::get_iface_names(&nl) == std::vector<std::string>{ "lo", "eth0" });
+    REQUIRE_THROWS_AS(netiface("eth1", &nl), network_exception);
+
+    netiface eth0("eth0", &nl);
+    REQUIRE(eth0.get_index() == index);
+    REQUIRE(eth0.get_mac_address().to_string() == "52:54:00:12:34:56");
+    REQUIRE(eth0.get_mtu() == 1500);
+    eth0.set_mtu(9000);
+    REQUIRE(eth0.get_mtu() == 9000);
+
+    // The whole state of the link comes from one request, and the getters can share it
+    link_info info = eth0.get_link_info();
+    REQUIRE(info.index == index);
+    REQUIRE(info.name == "eth0");
+    REQUIRE(info.mtu == 9000);
+    REQUIRE(info.mac.to_string() == "52:54:00:12:34:56");
+    REQUIRE((info.flags & IFF_UP) != 0);
+    REQUIRE(info.operstate == oper_state::up);
+    REQUIRE(info.txqueuelen == 1000);
+    REQUIRE(netiface("lo", &nl).get_link_info().operstate == oper_state::unknown);
+
+    eth0.set_link_info_max_age(std::chrono::seconds(60));
+    uint64_t requests = kernel.get_stats().requests;
+    REQUIRE(eth0.get_mtu() == 9000);
+    REQUIRE(eth0.get_mac_address().to_string() == "52:54:00:12:34:56");
+    REQUIRE(kernel.get_stats().requests == requests);
+    eth0.set_mtu(1500);
+    REQUIRE(eth0.get_mtu() == 1500);
+    eth0.set_link_info_max_age(std::chrono::milliseconds(0));
+    REQUIRE_THROWS_AS(eth0.set_mtu(10), network_exception);
+
+    // Addresses come back the way the kernel reports them, one family at a time if asked
+    ip_address v4("10.1.2.3", 24);
+    ip_address v6("2001:db8::1", 64);
+    REQUIRE(eth0.get_ip_addresses().empty());
+    eth0.set_ip_address(v4);
+    eth0.set_ip_addresses({ v4, v6 });
+    REQUIRE(eth0.get_ip_addresses() == std::vector<ip_address>{ v4, v6 });
+    REQUIRE(eth0.get_ip_addresses(ip_family_type::v6) == std::vector<ip_address>{ v6 });
+    eth0.del_ip_address(v4);
+    REQUIRE(eth0.get_ip_addresses() == std::vector<ip_address>{ v6 });
+
+    // Only the requested link is dumped
+    REQUIRE(netiface("lo", &nl).get_ip_addresses().size() == 2);
+
+    // Requests that the kernel would refuse are refused
+    nl_msg message = nl.init_message(RTM_DELADDR, NLM_F_REQUEST | NLM_F_ACK);
+    message.req.ifaddr.ifa_family = AF_INET;
+    message.req.ifaddr.ifa_index = 0x7FFFFFFF;
+    REQUIRE_THROWS_AS(nl.send_message_sync(message), network_exception);
+}
+
+TEST_CASE("netlink_emulator:Echo", "[netlink_emulator]")
+{
+    netlink_emulator kernel;
+    kernel.add_link("eth0");
+    netlink nl;
+    nl.use_transport(kernel.connect());
+    netiface eth0("eth0", &nl);
+
+    // IPv4 changes are echoed back, so each one is a single request against the index looked up in the constructor
+    auto requests = [&](auto operation) {
+        emulator_stats before = kernel.get_stats();
+        operation();
+        return kernel.get_stats().requests - before.requests;
+    };
+    ip_address v4("10.1.2.3", 24);
+    REQUIRE(requests([&]{ eth0.set_ip_address(v4); }) == 1);
+    REQUIRE(requests([&]{ eth0.set_ip_address(v4); }) == 2);
+    REQUIRE(requests([&]{ eth0.del_ip_address(v4); }) == 1);
+    REQUIRE(requests([&]{ eth0.del_ip_address(v4); }) == 1);
+    REQUIRE(eth0.get_ip_addresses().empty());
+
+    // IPv6 changes are not, so they are still looked for afterwards
+    ip_address v6("2001:db8::1", 64);
+    REQUIRE(requests([&]{ eth0.set_ip_address(v6); }) > 1);
+    REQUIRE(eth0.get_ip_addresses() == std::vector<ip_address>{ v6 });
+
+    // A batch only looks for the addresses that were not echoed
+    REQUIRE(requests([&]{ eth0.set_ip_addresses({ ip_address("10.0.0.1", 8), ip_address("10.0.0.2", 8) }); }) == 3);
+    REQUIRE(eth0.get_ip_addresses().size() == 3);
+}
+
+TEST_CASE("netlink_emulator:Recreated link", "[netlink_emulator]")
+{
+    netlink_emulator kernel;
+    iface_idx_t first = kernel.add_link("eth0");
+    netlink nl;
+    nl.use_transport(kernel.connect());
+    netiface eth0("eth0", &nl);
+    REQUIRE(eth0.get_index() == first);
+
+    // The old index is refused, so the interface is looked up again by name and the request repeated
+    kernel.del_link("eth0");
+    iface_idx_t second = kernel.add_link("eth0");
+    REQUIRE(second != first);
+    eth0.set_ip_address(ip_address("10.1.2.3", 24));
+    REQUIRE(eth0.get_index() == second);
+    REQUIRE(eth0.get_ip_addresses().size() == 1);
+
+    kernel.del_link("eth0");
+    kernel.add_link("eth0");
+    REQUIRE(eth0.get_ip_addresses().empty());
+
+    kernel.del_link("eth0");
+    REQUIRE_THROWS_AS(eth0.set_mtu(9000), network_exception);
+}
+
+TEST_CASE("netlink_emulator:Scale", "[netlink_emulator]")
+{
+    const int links = 5000;
+    netlink_emulator kernel;
+    for (int i = 0; i < links; ++i)
+    {
+        kernel.add_link(fmt::format("veth{}", i));
+    }
+    netlink nl;
+    nl.use_transport(kernel.connect());
+
+    // A large dump is split over many datagrams, like the kernel does
+    REQUIRE(netiface::get_iface_names(&nl).size() == links + 1);
+    REQUIRE(nl.get_stats().datagrams_received > 1);
+
+    // Pipelined requests reach the emulator in batches instead of one at a time
+    std::vector<ip_address> addresses;
+    for (int i = 0; i < 500; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.0.{}.{}", i / 250, i % 250 + 1), 16);
+    }
+    netiface veth("veth42", &nl);
+    emulator_stats before = kernel.get_stats();
+    veth.set_ip_addresses(addresses);
+    emulator_stats after = kernel.get_stats();
+    REQUIRE(veth.get_ip_addresses().size() == addresses.size());
+    REQUIRE(after.sends - before.sends < addresses.size() / 4);
+}
+
+TEST_CASE("netlink_emulator:Bulk acks", "[netlink_emulator]")
+{
+    netlink_emulator kernel;
+    kernel.add_link("veth0");
+    kernel.add_link("veth1");
+    netlink nl;
+    nl.use_transport(kernel.connect());
+    netiface veth("veth0", &nl);
+    netiface other("veth1", &nl);
+
+    std::vector<ip_address> addresses;
+    for (int i = 0; i < 300; ++i)
+    {
+        addresses.emplace_back(fmt::format("10.0.{}.{}", i / 250, i % 250 + 1), 16);
+    }
+
+    // The same changes with a barrier for each batch, then with an ACK for each request
+    nl.set_bulk_acks(true);
+    REQUIRE(nl.has_bulk_acks());
+    emulator_stats before = kernel.get_stats();
+    veth.set_ip_addresses(addresses);
+    emulator_stats bulk = kernel.get_stats();
+    REQUIRE(veth.get_ip_addresses().size() == addresses.size());
+    REQUIRE(nl.get_stats().barriers < addresses.size() / 4);
+
+    nl.set_bulk_acks(false);
+    emulator_stats middle = kernel.get_stats();
+    other.set_ip_addresses(addresses);
+    emulator_stats acked = kernel.get_stats();
+
+    // Both read the addresses back afterwards, so the difference is the ACKs the barriers stood in for
+    uint64_t saved = (acked.replies - middle.replies) - (bulk.replies - before.replies);
+    REQUIRE(saved + nl.get_stats().barriers >= addresses.size());
+
+    // Requests that fail still report their own error, and the ones around them still succeed or reply
+    std::vector<nl_msg> messages;
+    for (iface_idx_t index : { veth.get_index(), 0x7FFFFFFF, veth.get_index() })
+    {
+        messages.push_back(nl.init_message(RTM_GETLINK, NLM_F_REQUEST | NLM_F_ACK));
+        messages.back().req.ifinfo.ifi_index = index;
+    }
+    std::vector<size_t> replies;
+    std::vector<int> results = nl.send_messages(messages, [&](size_t idx, struct nlmsghdr*) { replies.push_back(idx); });
+    REQUIRE(results == std::vector<int>{ 0, ENODEV, 0 });
+    REQUIRE(replies == std::vector<size_t>{ 0, 2 });
+    REQUIRE(nl.get_stats().stale_messages == 0);
+}
+
+TEST_CASE("netlink_emulator:Throughput", "[.][benchmark]")
+{
+    // 100k links with a known cost for each syscall and each request, so the numbers only depend on the client
+    const int links = 100000;
+    const int addresses = 1000;
+    netlink_emulator kernel;
+    for (int i = 0; i < links; ++i)
+    {
+        kernel.add_link(fmt::format("veth{}", i));
+    }
+    kernel.set_latency(std::chrono::microseconds(1), std::chrono::microseconds(5));
+    netlink nl;
+    nl.use_transport(kernel.connect());
+
+    std::vector<ip_address> batch;
+    for (int i = 0; i < addresses; ++i)
+    {
+        batch.emplace_back(fmt::format("10.{}.{}.1", i / 256, i % 256), 24);
+    }
+    netiface veth("veth500", &nl);
+
+    BENCHMARK("dump 100k links")
+    {
+        netiface::get_iface_names(&nl);
+    }
+
+    BENCHMARK("add 1000 addresses one at a time")
+    {
+        for (const auto& address : batch)
+        {
+            veth.set_ip_address(address);
+        }
+    }
+    for (const auto& address : batch)
+    {
+        veth.del_ip_address(address);
+    }
+
+    emulator_stats before = kernel.get_stats();
+    BENCHMARK("add 1000 addresses pipelined")
+    {
+        veth.set_ip_addresses(batch);
+    }
+    emulator_stats after = kernel.get_stats();
+    WARN(fmt::format("pipelined: sends={} requests={}", after.sends - before.sends, after.requests - before.requests));
+}
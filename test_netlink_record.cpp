@@ -0,0 +1,102 @@
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "spdlog/fmt/fmt.h"
+#include "catch.hpp"
+#include "exceptions.hpp"
+#include "netiface.hpp"
+#include "netlink.hpp"
+
+using namespace fnc;
+
+/**
+ * @brief Get a path for a recording that is removed when it goes out of scope
+ */
+struct temp_recording
+{
+    std::string path = (std::filesystem::temp_directory_path() / fmt::format("fnc_test_{}.nlrec", getpid())).string();
+    ~temp_recording() { std::filesystem::remove(path); }
+};
+
+TEST_CASE("netlink_record:Replay", "[netlink_record]")
+{
+    temp_recording file;
+
+    std::vector<std::string> names;
+    mtu_t mtu;
+    std::vector<ip_address> addresses;
+    {
+        netlink nl;
+        nl.record_to(file.path);
+        names = netiface::get_iface_names(&nl);
+        netiface lo("lo", &nl);
+        mtu = lo.get_mtu();
+        addresses = lo.get_ip_addresses();
+        nl.stop_recording();
+    }
+
+    std::vector<netlink_record> records = read_recording(file.path);
+    REQUIRE(!records.empty());
+    REQUIRE(records.front().direction == record_direction::sent);
+    for (size_t idx = 1; idx < records.size(); ++idx)
+    {
+        REQUIRE(records[idx].timestamp >= records[idx - 1].timestamp);
+    }
+
+    // The same calls get the same answers without a socket
+    netlink nl;
+    nl.replay_from(file.path);
+    REQUIRE(nl.is_using_transport());
+    REQUIRE(nl.get_fd() < 0);
+    REQUIRE(netiface::get_iface_names(&nl) == names);
+    netiface lo("lo", &nl);
+    REQUIRE(lo.get_mtu() == mtu);
+    REQUIRE(lo.get_ip_addresses() == addresses);
+
+    // And anything that was not recorded fails instead of making something up
+    REQUIRE_THROWS_AS(lo.get_mac_address(), network_exception);
+}
+
+TEST_CASE("netlink_record:Diverged", "[netlink_record]")
+{
+    temp_recording file;
+    {
+        netlink nl;
+        nl.record_to(file.path);
+        netiface::get_iface_names(&nl);
+    }
+
+    // A different request than the one that was recorded is refused
+    netlink nl;
+    nl.replay_from(file.path);
+    REQUIRE_THROWS_AS(netiface("lo", &nl), network_exception);
+
+    REQUIRE_THROWS_AS(read_recording(file.path + ".missing"), fnc_exception);
+}
+
+TEST_CASE("netlink_record:Replay dump", "[.][benchmark]")
+{
+    temp_recording file;
+    {
+        netlink nl;
+        nl.record_to(file.path);
+        netiface::get_iface_names(&nl);
+    }
+    auto records = std::make_shared<const std::vector<netlink_record>>(read_recording(file.path));
+    WARN(fmt::format("datagrams={}", records->size()));
+
+    BENCHMARK("live link dump")
+    {
+        netiface::get_iface_names(&netlink::thread_session());
+    }
+
+    netlink nl;
+    BENCHMARK("replayed link dump")
+    {
+        nl.replay(records);
+        netiface::get_iface_names(&nl);
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace fnc
+{
+
+/**
+ * @brief A point in time that an operation has to be finished by
+ *
+ * Each wait is given whatever time is left instead of a fixed timeout, so every wait that makes up an operation,
+ * such as the parts of a multi-part reply, comes out of a single budget.
+ *
+ * @example
+ * @code
+ * deadline limit = deadline::after(std::chrono::milliseconds(50));
+ * while (!done)
+ * {
+ *     poll(&pfd, 1, limit.remaining().count());
+ *     ...
+ * }
+ * @endcode
+ */
+class deadline
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Constructor, for a deadline that never expires
+     */
+    deadline()
+        : expiry_(clock::time_point::max())
+    { }
+
+    /**
+     * @brief Get a deadline that expires after the given budget
+     *
+     * @param budget    how long from now, negative for a deadline that never expires
+     */
+    static deadline after(std::chrono::milliseconds budget)
+    {
+        deadline limit;
+        clock::time_point now = clock::now();
+        if (budget.count() >= 0 && budget < clock::time_point::max() - now)
+        {
+            limit.expiry_ = now + budget;
+        }
+        return limit;
+    }
+
+    /**
+     * @brief Get a deadline that never expires
+     */
+    static deadline never()
+    {
+        return deadline();
+    }
+
+    /**
+     * @brief Check if this deadline never expires
+     */
+    bool is_never() const
+    {
+        return expiry_ == clock::time_point::max();
+    }
+
+    /**
+     * @brief Check if this deadline has passed
+     */
+    bool expired() const
+    {
+        return !is_never() && clock::now() >= expiry_;
+    }
+
+    /**
+     * @brief Get the time left before this deadline, rounded up to a whole millisecond
+     *
+     * @return the time left, 0 if it has passed, or -1 if it never expires, which is what poll and io_ring::submit
+     *         take as a timeout
+     */
+    std::chrono::milliseconds remaining() const
+    {
+        if (is_never())
+        {
+            return std::chrono::milliseconds(-1);
+        }
+        return std::max(std::chrono::ceil<std::chrono::milliseconds>(expiry_ - clock::now()), std::chrono::milliseconds(0));
+    }
+
+    /**
+     * @brief Get whichever of two deadlines expires first
+     */
+    static deadline earliest(const deadline& first, const deadline& second)
+    {
+        return first.expiry_ <= second.expiry_ ? first : second;
+    }
+
+private:
+    clock::time_point expiry_;
+};
+
+} // end namespace fnc